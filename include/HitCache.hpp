@@ -0,0 +1,99 @@
+#ifndef HITCACHE_H
+#define HITCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Track.hpp"
+
+/**
+ *  Compact columnar cache of the hits 1convert reads from ROOT.
+ *
+ *  Only hits passing the -9000 sentinel check are kept, with the columns of
+ *  \c HitColumn as float32. Every track is kept, also without any such hit,
+ *  and no track or hit cut is applied, so conversions with other cuts or
+ *  label hierarchies can run from the cache without ROOT and see the same
+ *  tracks.
+ *
+ *  File layout: the 8 byte magic \c "MPHITC02", then chunks and a footer.
+ *  Each chunk holds \c nTracks and \c nHits (uint64) followed by the track
+ *  columns (x, y, chi2, px, py, pz, charge as float32, nRawHits as int32,
+ *  run and time as int64, hits per track as int32) and the hit columns (id
+ *  as int32, then every \c HitColumn as float32). The footer is the marker
+ *  \c kFooter in place of \c nTracks, then the total number of tracks and
+ *  hits (uint64), so a file cut at a chunk boundary is detected.
+ *  Every array starts on an 8 byte boundary.
+ */
+
+/// Write tracks to a hit cache, one chunk per \c chunkHits buffered hits.
+class HitCacheWriter
+{
+public:
+  explicit HitCacheWriter(const std::string &fileName, std::size_t chunkHits = 1 << 16);
+  ~HitCacheWriter();
+
+  bool isOpen() const { return myFile.is_open(); }
+  void write(const TrackView &track);
+  bool close();
+
+  std::uint64_t numTracks() const { return myTotalTracks; } ///< tracks written so far
+  std::uint64_t numHits() const { return myTotalHits; }     ///< hits written so far
+
+private:
+  void flush();
+  template <typename T>
+  void writeColumn(const T *data, std::size_t n);
+
+  std::ofstream myFile;
+  std::size_t myChunkHits;
+  std::vector<TrackInfo> myInfo; ///< buffered tracks of the current chunk
+  std::vector<int> myNumHits;    ///< hits per buffered track
+  std::vector<int> myId;
+  std::vector<float> myHit[kNumHitColumns];
+  std::uint64_t myTotalTracks = 0;
+  std::uint64_t myTotalHits = 0;
+  bool myFailed = false; ///< a write failed, reported by close()
+};
+
+/// Stream tracks from a memory-mapped hit cache.
+class HitCacheReader
+{
+public:
+  explicit HitCacheReader(const std::string &fileName);
+  ~HitCacheReader();
+  HitCacheReader(const HitCacheReader &) = delete;
+  HitCacheReader &operator=(const HitCacheReader &) = delete;
+
+  bool isOpen() const { return myData != nullptr; }
+  bool next(TrackView &track);
+  bool complete() const { return myComplete; } ///< footer read and matching, valid after next() returned false
+
+private:
+  bool nextChunk();
+  template <typename T>
+  const T *column(std::size_t n);
+
+  const char *myData = nullptr; ///< mapped file
+  std::size_t mySize = 0;       ///< size of the mapped file
+  std::size_t myPos = 0;        ///< read position in the mapped file
+  bool myBroken = false;        ///< chunk overruns the file
+  bool myComplete = false;      ///< footer read and matching
+  std::uint64_t myTotalTracks = 0;
+  std::uint64_t myTotalHits = 0;
+
+  // current chunk
+  std::uint64_t myNumTracks = 0;
+  std::uint64_t myTrack = 0;
+  std::uint64_t myHitPos = 0;
+  const float *myTrackFloat[7] = {nullptr};
+  const std::int32_t *myNumRaw = nullptr;
+  const std::int64_t *myRun = nullptr;
+  const std::int64_t *myTime = nullptr;
+  const std::int32_t *myNumHits = nullptr;
+  const std::int32_t *myId = nullptr;
+  const float *myHit[kNumHitColumns] = {nullptr};
+};
+#endif
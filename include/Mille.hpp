@@ -33,6 +33,8 @@
  *  Use its member functions \c mille(), \c special(), \c kill() and \c end()
  *  as you would use the fortran \ref mille.f90 "MILLE"
  *  and its entry points \c MILLSP, \c KILLE and \c ENDLE.
+ *  \c milleTrack() adds all measurements of a track at once, stored as
+ *  row-major arrays with one row per measurement.
  *
  *  For debugging purposes constructor flags enable switching to text output and/or
  *  to write also derivatives and labels which are ==0.
@@ -50,11 +52,14 @@
 class Mille 
 {
  public:
-  Mille(const char *outFileName, bool asBinary = true, bool writeZero = false);
+  Mille(const char *outFileName, bool asBinary = true, bool writeZero = false,
+	bool append = false);
   ~Mille();
 
   void mille(int NLC, const float *derLc, int NGL, const float *derGl,
 	     const int *label, float rMeas, float sigma);
+  void milleTrack(int nHit, int NLC, const float *derLc, int NGL, const float *derGl,
+		  const int *label, const float *rMeas, const float *sigma);
   void special(int nSpecial, const float *floatings, const int *integers);
   void kill();
   void end();
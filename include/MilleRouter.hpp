@@ -0,0 +1,63 @@
+#ifndef MILLEROUTER_H
+#define MILLEROUTER_H
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Mille.hpp"
+
+/**
+ * \class MilleRouter
+ *
+ *  Routes track records to one Mille output per partition tag (run number,
+ *  time window, ...) so that a single pass over the input fills all outputs.
+ *
+ *  Outputs are opened lazily on the first record of a tag. At most
+ *  \c maxOpen files are kept open; the least recently used one is closed
+ *  and reopened in append mode when needed again.
+ *  The empty tag maps to \c outBase + \c extension itself.
+ *
+ *  For every non-empty tag a steering file \c <outBase>_<tag>_str.txt is
+ *  written by \c close(), either copied from a template with the binary
+ *  file name replaced, or a minimal one with only the \c Cfiles section.
+ */
+class MilleRouter
+{
+public:
+  MilleRouter(const std::string &outBase, const std::string &extension,
+              bool asBinary, bool writeZero, std::size_t maxOpen = 64,
+              const std::string &steeringTemplate = "");
+  ~MilleRouter();
+
+  Mille &get(const std::string &tag);
+  void close();
+
+  std::string fileName(const std::string &tag) const;
+  std::vector<std::string> fileNames() const;
+  std::size_t size() const { return myOutputs.size(); } ///< number of outputs created so far
+
+private:
+  /// One output: the writer is null while the file is closed.
+  struct Output
+  {
+    std::unique_ptr<Mille> mille;
+    unsigned long long lastUse = 0;
+  };
+
+  void closeLeastRecentlyUsed();
+  void writeSteering(const std::string &tag) const;
+
+  std::string myOutBase;          ///< output file name without extension
+  std::string myExtension;        ///< ".bin" or ".txt"
+  bool myAsBinary;                ///< passed to Mille
+  bool myWriteZero;               ///< passed to Mille
+  std::size_t myMaxOpen;          ///< cap on simultaneously open files
+  std::string mySteeringTemplate; ///< steering file to copy, empty for a minimal one
+  std::map<std::string, Output> myOutputs;
+  std::size_t myNumOpen = 0;         ///< number of outputs currently open
+  unsigned long long myUseCount = 0; ///< clock for least recently used
+};
+#endif
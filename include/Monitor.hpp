@@ -0,0 +1,52 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+/// Fixed binning histogram, bins[0] is the underflow and bins[n+1] the overflow.
+struct Histogram1D
+{
+  Histogram1D(int nBins, double low, double high);
+
+  void fill(double value);
+  void merge(const Histogram1D &other);
+
+  double low;
+  double high;
+  std::vector<unsigned long long> bins;
+};
+
+/**
+ * \class Monitor
+ *
+ *  Monitoring histograms filled by 1convert while it writes the records:
+ *  residuals, pulls (residual / sigma), the derivative of the residual by
+ *  the module x shift, track momentum |p| and pz and the number of hits per
+ *  module, layer and station label. Tracks without any written measurement are not filled.
+ *
+ *  Instances are independent, fill one per input chunk (file, thread, ...)
+ *  and \c merge() them at the end.
+ */
+class Monitor
+{
+public:
+  Monitor();
+
+  void fillTrack(float px, float py, float pz);
+  void fillHit(float residual, float sigma, float derivative, int moduleLabel, int layerLabel, int stationLabel);
+  void merge(const Monitor &other);
+  bool write(const std::string &fileName) const;
+
+private:
+  Histogram1D myResidual;
+  Histogram1D myPull;
+  Histogram1D myDerivative;
+  Histogram1D myMomentum;
+  Histogram1D myMomentumZ;
+  std::map<int, unsigned long long> myModuleHits;  ///< hits per first module label
+  std::map<int, unsigned long long> myLayerHits;   ///< hits per first layer label
+  std::map<int, unsigned long long> myStationHits; ///< hits per first station label
+};
+#endif
@@ -0,0 +1,60 @@
+#ifndef RECORDSORTER_H
+#define RECORDSORTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * \class RecordSorter
+ *
+ *  Reorders the records of a binary Mille file so that tracks touching the
+ *  same global labels follow each other, which keeps the matrix rows pede
+ *  updates for consecutive records close in memory.
+ *
+ *  Records are ordered by their layer signature, a bit mask of the layers
+ *  (module label / 1000, layer label / 10, station label / 10) they have
+ *  global labels in, then by their smallest module label. Order within
+ *  equal keys is kept.
+ *
+ *  At most \c memoryBytes of records are sorted in memory at a time; larger
+ *  files are sorted in runs written next to the file and merged back, at
+ *  most 64 runs per pass, so no more than 65 files are open at once.
+ */
+class RecordSorter
+{
+public:
+  explicit RecordSorter(std::size_t memoryBytes = std::size_t(1) << 30);
+
+  bool sort(const std::string &fileName);
+
+  std::uint64_t numRecords() const { return myNumRecords; }         ///< records in the last file
+  std::uint64_t numRuns() const { return myNumRuns; }               ///< sorted runs of the last file
+  std::uint64_t changesBefore() const { return myChangesBefore; }   ///< signature changes in input order
+  std::uint64_t changesAfter() const { return myChangesAfter; }     ///< signature changes after sorting
+
+  /// Sort key of a record, given its float and int words.
+  struct Key
+  {
+    std::uint64_t signature = 0;
+    int firstModule = 0;
+    bool operator<(const Key &other) const
+    {
+      return signature != other.signature ? signature < other.signature
+                                          : firstModule < other.firstModule;
+    }
+    bool operator==(const Key &other) const
+    {
+      return signature == other.signature && firstModule == other.firstModule;
+    }
+  };
+  static Key key(const float *floats, const int *ints, int nWords);
+
+private:
+  std::size_t myMemoryBytes;
+  std::uint64_t myNumRecords = 0;
+  std::uint64_t myNumRuns = 0;
+  std::uint64_t myChangesBefore = 0;
+  std::uint64_t myChangesAfter = 0;
+};
+#endif
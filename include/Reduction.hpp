@@ -0,0 +1,75 @@
+#ifndef REDUCTION_H
+#define REDUCTION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "Track.hpp"
+
+/// 64 bit fingerprint of a track from fitParam_x/y/px/py/pz/charge and the hit ids.
+std::uint64_t trackFingerprint(const TrackView &track);
+
+/**
+ *  Deterministic prescaling: a track is kept if its fingerprint, mapped to
+ *  [0, 1), is below the fraction. The same track is always kept or always
+ *  dropped, independent of file order or of the other tracks.
+ */
+class Prescaler
+{
+public:
+  explicit Prescaler(double fraction = 1.) : myFraction(fraction) {}
+
+  bool enabled() const { return myFraction < 1.; }
+  bool keep(const TrackView &track) const;
+
+private:
+  double myFraction; ///< fraction of tracks to keep
+};
+
+/**
+ *  Occupancy cap: at most \c maxHits measurements are emitted per label,
+ *  later hits on that label are dropped while sparse labels keep all theirs.
+ *  A cap of 0 disables it.
+ */
+class OccupancyCap
+{
+public:
+  explicit OccupancyCap(unsigned long long maxHits = 0) : myMaxHits(maxHits) {}
+
+  bool enabled() const { return myMaxHits > 0; }
+  bool full(int label) const;
+  void add(int label) { ++myHits[label]; }
+
+private:
+  unsigned long long myMaxHits;
+  std::unordered_map<int, unsigned long long> myHits; ///< emitted hits per label
+};
+
+/**
+ *  Set of track fingerprints for removing duplicated tracks, e.g. from
+ *  overlapping reprocessed input files.
+ *
+ *  Open addressing over the 64 bit fingerprints themselves, 8 bytes per
+ *  slot at a load between 3/8 and 3/4, so 10^8 tracks need 1 to 2 GB.
+ *  While the table doubles the old and the new one both exist, so the
+ *  peak is 1.5 times the new table, ~3 GB around 10^8 tracks.
+ *  Two different tracks collide with probability ~n^2 / 2^65, i.e. ~3e-4
+ *  in total for 10^8 tracks.
+ */
+class FingerprintSet
+{
+public:
+  FingerprintSet();
+
+  bool insert(std::uint64_t fingerprint);
+  std::size_t size() const { return mySize; }
+
+private:
+  void grow();
+
+  std::vector<std::uint64_t> mySlots; ///< 0 marks an empty slot
+  std::size_t mySize = 0;
+};
+#endif
@@ -0,0 +1,80 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <vector>
+
+/// Per-hit float columns used by 1convert, named after the fitParam_align_* branches.
+enum HitColumn
+{
+  kResidualX,      ///< local_residual_x
+  kMeasuredXe,     ///< local_measured_xe
+  kDerivationXX,   ///< local_derivation_x_x
+  kDerivationXY,   ///< local_derivation_x_y
+  kDerivationXZ,   ///< local_derivation_x_z
+  kDerivationXRx,  ///< local_derivation_x_rx
+  kDerivationXRy,  ///< local_derivation_x_ry
+  kDerivationXRz,  ///< local_derivation_x_rz
+  kGlobalYX,       ///< global_derivation_y_x
+  kGlobalYY,       ///< global_derivation_y_y
+  kGlobalYZ,       ///< global_derivation_y_z
+  kGlobalYRx,      ///< global_derivation_y_rx
+  kGlobalYRy,      ///< global_derivation_y_ry
+  kGlobalYRz,      ///< global_derivation_y_rz
+  kParX,           ///< local_derivation_x_par_x
+  kParY,           ///< local_derivation_x_par_y
+  kParTheta,       ///< local_derivation_x_par_theta
+  kParPhi,         ///< local_derivation_x_par_phi
+  kParQop,         ///< local_derivation_x_par_qop
+  kNumHitColumns
+};
+
+/// Track-level values of the fitParam_* branches plus run/time metadata.
+struct TrackInfo
+{
+  float x = 0;
+  float y = 0;
+  float chi2 = 0;
+  float px = 0;
+  float py = 0;
+  float pz = 0;
+  float charge = 0;
+  int nRawHits = 0;    ///< hits before the sentinel check, used by the track cuts
+  long long run = -1;  ///< run number, -1 if unknown
+  long long time = -1; ///< event time in seconds, -1 if unknown
+};
+
+/// Non-owning structure-of-arrays view of one track, from ROOT or from the hit cache.
+struct TrackView
+{
+  TrackInfo info;
+  int nHits = 0;
+  const int *id = nullptr;                       ///< fitParam_align_id
+  const float *hit[kNumHitColumns] = {nullptr}; ///< indexed by HitColumn
+};
+
+/// Owning buffer for one track; the vectors are reused from track to track.
+struct TrackHits
+{
+  TrackInfo info;
+  std::vector<int> id;
+  std::vector<float> hit[kNumHitColumns];
+
+  void clear()
+  {
+    id.clear();
+    for (auto &column : hit)
+      column.clear();
+  }
+
+  TrackView view() const
+  {
+    TrackView track;
+    track.info = info;
+    track.nHits = static_cast<int>(id.size());
+    track.id = id.data();
+    for (int c = 0; c < kNumHitColumns; ++c)
+      track.hit[c] = hit[c].data();
+    return track;
+  }
+};
+#endif
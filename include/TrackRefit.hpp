@@ -0,0 +1,51 @@
+#ifndef TRACKREFIT_H
+#define TRACKREFIT_H
+
+#include <string>
+#include <vector>
+
+/**
+ * \class TrackRefit
+ *
+ *  Robust refit of the local track parameters before the record is written.
+ *
+ *  The residuals are linear in corrections to the local parameters through
+ *  the local derivatives, so the corrections are fitted by iteratively
+ *  reweighted least squares with an M-estimator on the normalised residuals
+ *  t = (r - A * dp) / sigma:
+ *   - Huber:  w = 1 for |t| <= c, else c / |t|       (c = 1.345)
+ *   - Cauchy: w = 1 / (1 + (t / c)^2)                (c = 2.3849)
+ *
+ *  Measurements with a final weight below \c minWeight are dropped, the
+ *  others keep their residual and get sigma / sqrt(w), so pede starts from
+ *  downweighted outliers instead of finding them in extra iterations.
+ */
+class TrackRefit
+{
+public:
+  enum Estimator
+  {
+    kNone,
+    kHuber,
+    kCauchy
+  };
+
+  explicit TrackRefit(Estimator estimator = kNone, double minWeight = 0.1, int maxIterations = 10);
+
+  static bool parse(const std::string &name, Estimator &estimator);
+
+  bool enabled() const { return myEstimator != kNone; }
+  bool fit(int nHit, int NLC, const float *derLc, const float *rMeas, const float *sigma);
+
+  double minWeight() const { return myMinWeight; }
+  const std::vector<double> &weights() const { return myWeights; } ///< per measurement, from the last fit
+
+private:
+  double weight(double t) const;
+
+  Estimator myEstimator;
+  double myMinWeight;
+  int myMaxIterations;
+  std::vector<double> myWeights;
+};
+#endif
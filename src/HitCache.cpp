@@ -0,0 +1,305 @@
+#include "HitCache.hpp"
+
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+  const char kMagic[8] = {'M', 'P', 'H', 'I', 'T', 'C', '0', '2'};
+
+  /// Marks the footer in place of the number of tracks of a chunk.
+  const std::uint64_t kFooter = ~std::uint64_t(0);
+
+  /// Float track columns in file order.
+  float TrackInfo::*const kTrackFloats[7] = {
+      &TrackInfo::x, &TrackInfo::y, &TrackInfo::chi2,
+      &TrackInfo::px, &TrackInfo::py, &TrackInfo::pz, &TrackInfo::charge};
+
+  std::size_t padded(std::size_t bytes)
+  {
+    return (bytes + 7) & ~std::size_t(7);
+  }
+}
+
+//___________________________________________________________________________
+
+/// Opens fileName and writes the magic.
+/**
+ * \param[in] fileName   cache file name
+ * \param[in] chunkHits  number of hits buffered before a chunk is written
+ */
+HitCacheWriter::HitCacheWriter(const std::string &fileName, std::size_t chunkHits)
+    : myFile(fileName, std::ios::binary | std::ios::out), myChunkHits(chunkHits)
+{
+  if (!myFile.is_open())
+  {
+    std::cerr << "HitCacheWriter::HitCacheWriter: Could not open " << fileName
+              << " as output file." << std::endl;
+    return;
+  }
+  myFile.write(kMagic, sizeof(kMagic));
+}
+
+HitCacheWriter::~HitCacheWriter()
+{
+  close();
+}
+
+/// Buffer one track, also without hits.
+void HitCacheWriter::write(const TrackView &track)
+{
+  if (!myFile.is_open())
+    return;
+  myInfo.push_back(track.info);
+  myNumHits.push_back(track.nHits);
+  myId.insert(myId.end(), track.id, track.id + track.nHits);
+  for (int c = 0; c < kNumHitColumns; ++c)
+    myHit[c].insert(myHit[c].end(), track.hit[c], track.hit[c] + track.nHits);
+  if (myId.size() >= myChunkHits || myInfo.size() >= myChunkHits)
+    flush();
+}
+
+/// Write the last chunk and the footer and close the file.
+/**
+ * \return false if any write failed, the file is then incomplete
+ */
+bool HitCacheWriter::close()
+{
+  if (!myFile.is_open())
+    return !myFailed;
+  flush();
+  const std::uint64_t footer[3] = {kFooter, myTotalTracks, myTotalHits};
+  myFile.write(reinterpret_cast<const char *>(footer), sizeof(footer));
+  myFile.close();
+  if (!myFile)
+    myFailed = true;
+  if (myFailed)
+    std::cerr << "HitCacheWriter::close: Could not write the hit cache, it is incomplete." << std::endl;
+  return !myFailed;
+}
+
+template <typename T>
+void HitCacheWriter::writeColumn(const T *data, std::size_t n)
+{
+  static const char zeros[8] = {0};
+  myFile.write(reinterpret_cast<const char *>(data), n * sizeof(T));
+  myFile.write(zeros, padded(n * sizeof(T)) - n * sizeof(T));
+}
+
+/// Transpose the buffered tracks into one chunk.
+void HitCacheWriter::flush()
+{
+  const std::uint64_t nTracks = myInfo.size();
+  const std::uint64_t nHits = myId.size();
+  if (nTracks == 0)
+    return;
+  myFile.write(reinterpret_cast<const char *>(&nTracks), sizeof(nTracks));
+  myFile.write(reinterpret_cast<const char *>(&nHits), sizeof(nHits));
+
+  std::vector<float> floats(nTracks);
+  for (auto member : kTrackFloats)
+  {
+    for (std::size_t i = 0; i < nTracks; ++i)
+      floats[i] = myInfo[i].*member;
+    writeColumn(floats.data(), nTracks);
+  }
+  std::vector<std::int32_t> nRaw(nTracks);
+  std::vector<std::int64_t> run(nTracks), time(nTracks);
+  for (std::size_t i = 0; i < nTracks; ++i)
+  {
+    nRaw[i] = myInfo[i].nRawHits;
+    run[i] = myInfo[i].run;
+    time[i] = myInfo[i].time;
+  }
+  writeColumn(nRaw.data(), nTracks);
+  writeColumn(run.data(), nTracks);
+  writeColumn(time.data(), nTracks);
+  writeColumn(myNumHits.data(), nTracks);
+
+  writeColumn(myId.data(), nHits);
+  for (int c = 0; c < kNumHitColumns; ++c)
+    writeColumn(myHit[c].data(), nHits);
+
+  if (!myFile)
+    myFailed = true;
+  myTotalTracks += nTracks;
+  myTotalHits += nHits;
+  myInfo.clear();
+  myNumHits.clear();
+  myId.clear();
+  for (auto &column : myHit)
+    column.clear();
+}
+
+//___________________________________________________________________________
+
+/// Maps fileName read-only and checks the magic.
+HitCacheReader::HitCacheReader(const std::string &fileName)
+{
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    std::cerr << "HitCacheReader::HitCacheReader: Could not open " << fileName
+              << " as input file." << std::endl;
+    return;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(kMagic)))
+  {
+    void *data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED)
+    {
+      myData = static_cast<const char *>(data);
+      mySize = st.st_size;
+      ::madvise(data, mySize, MADV_SEQUENTIAL);
+    }
+  }
+  ::close(fd);
+
+  if (!myData || std::memcmp(myData, kMagic, sizeof(kMagic)) != 0)
+  {
+    std::cerr << "HitCacheReader::HitCacheReader: " << fileName
+              << " is not a hit cache file." << std::endl;
+    if (myData)
+      ::munmap(const_cast<char *>(myData), mySize);
+    myData = nullptr;
+    return;
+  }
+  myPos = sizeof(kMagic);
+}
+
+HitCacheReader::~HitCacheReader()
+{
+  if (myData)
+    ::munmap(const_cast<char *>(myData), mySize);
+}
+
+/// Point track to the next track of the cache.
+/**
+ * \param[out] track  valid until the reader is destroyed
+ * \return     false at the end of the file or at a corrupt chunk, see \c complete()
+ */
+bool HitCacheReader::next(TrackView &track)
+{
+  if (!myData)
+    return false;
+  while (myTrack == myNumTracks)
+  {
+    if (!nextChunk())
+      return false;
+  }
+  TrackInfo &info = track.info;
+  for (int i = 0; i < 7; ++i)
+    info.*kTrackFloats[i] = myTrackFloat[i][myTrack];
+  info.nRawHits = myNumRaw[myTrack];
+  info.run = myRun[myTrack];
+  info.time = myTime[myTrack];
+  track.nHits = myNumHits[myTrack];
+  track.id = myId + myHitPos;
+  for (int c = 0; c < kNumHitColumns; ++c)
+    track.hit[c] = myHit[c] + myHitPos;
+  myHitPos += track.nHits;
+  ++myTrack;
+  return true;
+}
+
+template <typename T>
+const T *HitCacheReader::column(std::size_t n)
+{
+  // compare counts, not bytes, so a corrupt n cannot overflow n * sizeof(T)
+  if (myBroken || n > (mySize - myPos) / sizeof(T))
+  {
+    myBroken = true;
+    return nullptr;
+  }
+  const std::size_t bytes = padded(n * sizeof(T));
+  if (bytes > mySize - myPos)
+  {
+    myBroken = true;
+    return nullptr;
+  }
+  const T *data = reinterpret_cast<const T *>(myData + myPos);
+  myPos += bytes;
+  return data;
+}
+
+/// Set the column pointers to the next chunk.
+bool HitCacheReader::nextChunk()
+{
+  if (myBroken || myComplete)
+    return false;
+  if (myPos == mySize)
+  {
+    std::cerr << "HitCacheReader::nextChunk: No footer, the hit cache is truncated." << std::endl;
+    return false;
+  }
+  const std::uint64_t *header = column<std::uint64_t>(2);
+  if (!header)
+  {
+    std::cerr << "HitCacheReader::nextChunk: Truncated chunk header." << std::endl;
+    return false;
+  }
+  if (header[0] == kFooter)
+  {
+    const std::uint64_t *totalHits = column<std::uint64_t>(1);
+    if (!totalHits || header[1] != myTotalTracks || *totalHits != myTotalHits || myPos != mySize)
+    {
+      std::cerr << "HitCacheReader::nextChunk: Footer does not match the " << myTotalTracks
+                << " tracks and " << myTotalHits << " hits read." << std::endl;
+      myBroken = true;
+      return false;
+    }
+    myComplete = true;
+    return false;
+  }
+  myNumTracks = header[0];
+  const std::uint64_t nHits = header[1];
+  // every track and hit needs at least its column entries, reject sizes beyond the file
+  const std::uint64_t left = mySize - myPos;
+  const std::uint64_t trackBytes = 7 * sizeof(float) + 2 * sizeof(std::int32_t) + 2 * sizeof(std::int64_t);
+  const std::uint64_t hitBytes = sizeof(std::int32_t) + kNumHitColumns * sizeof(float);
+  if (myNumTracks > left / trackBytes || nHits > left / hitBytes ||
+      myNumTracks * trackBytes + nHits * hitBytes > left)
+    myBroken = true;
+  for (auto &floats : myTrackFloat)
+    floats = column<float>(myNumTracks);
+  myNumRaw = column<std::int32_t>(myNumTracks);
+  myRun = column<std::int64_t>(myNumTracks);
+  myTime = column<std::int64_t>(myNumTracks);
+  myNumHits = column<std::int32_t>(myNumTracks);
+  myId = column<std::int32_t>(nHits);
+  for (auto &floats : myHit)
+    floats = column<float>(nHits);
+  if (myBroken)
+  {
+    std::cerr << "HitCacheReader::nextChunk: Truncated chunk of " << myNumTracks
+              << " tracks." << std::endl;
+    myNumTracks = 0;
+    return false;
+  }
+  // hits per track must be non-negative and add up to the hits of the chunk
+  std::uint64_t sum = 0;
+  for (std::uint64_t i = 0; i < myNumTracks; ++i)
+  {
+    if (myNumHits[i] < 0 || (sum += myNumHits[i]) > nHits)
+      break;
+  }
+  if (sum != nHits)
+  {
+    std::cerr << "HitCacheReader::nextChunk: Hits per track do not match the " << nHits
+              << " hits of the chunk." << std::endl;
+    myBroken = true;
+    myNumTracks = 0;
+    return false;
+  }
+  myTotalTracks += myNumTracks;
+  myTotalHits += nHits;
+  myTrack = 0;
+  myHitPos = 0;
+  return true;
+}
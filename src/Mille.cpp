@@ -41,9 +41,11 @@
  * \param[in] outFileName  file name
  * \param[in] asBinary     flag for binary
  * \param[in] writeZero    flag for keeping of zeros
+ * \param[in] append       flag for appending to an existing file
  */
-Mille::Mille(const char *outFileName, bool asBinary, bool writeZero) : 
-  myOutFile(outFileName, (asBinary ? (std::ios::binary | std::ios::out) : std::ios::out)),
+Mille::Mille(const char *outFileName, bool asBinary, bool writeZero, bool append) : 
+  myOutFile(outFileName, (asBinary ? (std::ios::binary | std::ios::out) : std::ios::out)
+	    | (append ? std::ios::app : std::ios::openmode())),
   myAsBinary(asBinary), myWriteZero(writeZero), myBufferPos(-1), myHasSpecial(false)
 {
   // Instead myBufferPos(-1), myHasSpecial(false) and the following two lines
@@ -79,39 +81,63 @@ void Mille::mille(int NLC, const float *derLc,
 		  int NGL, const float *derGl, const int *label,
 		  float rMeas, float sigma)
 {
-  if (sigma <= 0.) return;
-  if (myBufferPos == -1) this->newSet(); // start, e.g. new track
-  if (!this->checkBufferSize(NLC, NGL)) return;
-
-  // first store measurement
-  ++myBufferPos;
-  myBufferFloat[myBufferPos] = rMeas;
-  myBufferInt  [myBufferPos] = 0;
+  this->milleTrack(1, NLC, derLc, NGL, derGl, label, &rMeas, &sigma);
+}
 
-  // store local derivatives and local 'lables' 1,...,NLC
-  for (int i = 0; i < NLC; ++i) {
-    if (derLc[i] || myWriteZero) { // by default store only non-zero derivatives
-      ++myBufferPos;
-      myBufferFloat[myBufferPos] = derLc[i]; // local derivatives
-      myBufferInt  [myBufferPos] = i+1;      // index of local parameter
-    }
-  }
+//___________________________________________________________________________
+/// Add all measurements of a track to buffer.
+/**
+ * Same result as calling mille() for every row, which is implemented
+ * as a track of one measurement.
+ *
+ * \param[in]    nHit   number of measurements
+ * \param[in]    NLC    number of local derivatives per measurement
+ * \param[in]    derLc  local derivatives, nHit x NLC
+ * \param[in]    NGL    number of global derivatives per measurement
+ * \param[in]    derGl  global derivatives, nHit x NGL
+ * \param[in]    label  global labels, nHit x NGL
+ * \param[in]    rMeas  measurements (residua), nHit
+ * \param[in]    sigma  errors, nHit
+ */
+void Mille::milleTrack(int nHit, int NLC, const float *derLc,
+		       int NGL, const float *derGl, const int *label,
+		       const float *rMeas, const float *sigma)
+{
+  for (int iHit = 0; iHit < nHit; ++iHit, derLc += NLC, derGl += NGL, label += NGL) {
+    if (sigma[iHit] <= 0.) continue;
+    if (myBufferPos == -1) this->newSet(); // start, e.g. new track
+    if (!this->checkBufferSize(NLC, NGL)) continue;
 
-  // store uncertainty of measurement in between locals and globals
-  ++myBufferPos;
-  myBufferFloat[myBufferPos] = sigma;
-  myBufferInt  [myBufferPos] = 0;
+    // first store measurement
+    ++myBufferPos;
+    myBufferFloat[myBufferPos] = rMeas[iHit];
+    myBufferInt  [myBufferPos] = 0;
 
-  // store global derivatives and their labels
-  for (int i = 0; i < NGL; ++i) {
-    if (derGl[i] || myWriteZero) { // by default store only non-zero derivatives
-      if ((label[i] > 0 || myWriteZero) && label[i] <= myMaxLabel) { // and for valid labels
+    // store local derivatives and local 'lables' 1,...,NLC
+    for (int i = 0; i < NLC; ++i) {
+      if (derLc[i] || myWriteZero) { // by default store only non-zero derivatives
 	++myBufferPos;
-	myBufferFloat[myBufferPos] = derGl[i]; // global derivatives
-	myBufferInt  [myBufferPos] = label[i]; // index of global parameter
-      } else {
-	std::cerr << "Mille::mille: Invalid label " << label[i] 
-		  << " <= 0 or > " << myMaxLabel << std::endl; 
+	myBufferFloat[myBufferPos] = derLc[i]; // local derivatives
+	myBufferInt  [myBufferPos] = i+1;      // index of local parameter
+      }
+    }
+
+    // store uncertainty of measurement in between locals and globals
+    ++myBufferPos;
+    myBufferFloat[myBufferPos] = sigma[iHit];
+    myBufferInt  [myBufferPos] = 0;
+
+    // store global derivatives and their labels
+    for (int i = 0; i < NGL; ++i) {
+      if (derGl[i] || myWriteZero) { // by default store only non-zero derivatives
+	if ((label[i] > 0 || myWriteZero) && label[i] <= myMaxLabel) { // and for valid labels
+	  ++myBufferPos;
+	  myBufferFloat[myBufferPos] = derGl[i]; // global derivatives
+	  myBufferInt  [myBufferPos] = label[i]; // index of global parameter
+	} else {
+	  std::cerr << "Mille::mille: Invalid label " << label[i]
+		    << " <= 0 or > " << myMaxLabel << std::endl;
+	}
       }
     }
   }
@@ -0,0 +1,139 @@
+#include "MilleRouter.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+/// Prepare the routing; no file is opened before the first \c get().
+/**
+ * \param[in] outBase           output file name without extension
+ * \param[in] extension         extension of the Mille files
+ * \param[in] asBinary          flag for binary, passed to Mille
+ * \param[in] writeZero         flag for keeping of zeros, passed to Mille
+ * \param[in] maxOpen           maximum number of simultaneously open files
+ * \param[in] steeringTemplate  steering file to copy for every tag (optional)
+ */
+MilleRouter::MilleRouter(const std::string &outBase, const std::string &extension,
+                         bool asBinary, bool writeZero, std::size_t maxOpen,
+                         const std::string &steeringTemplate)
+    : myOutBase(outBase), myExtension(extension), myAsBinary(asBinary),
+      myWriteZero(writeZero), myMaxOpen(maxOpen > 0 ? maxOpen : 1),
+      mySteeringTemplate(steeringTemplate)
+{
+}
+
+MilleRouter::~MilleRouter()
+{
+  close();
+}
+
+/// Writer for the given tag, opened (or reopened for appending) on demand.
+/**
+ * Only call between records, i.e. after \c Mille::end() of the previous track,
+ * since the returned writer may close another one.
+ */
+Mille &MilleRouter::get(const std::string &tag)
+{
+  auto found = myOutputs.find(tag);
+  bool append = (found != myOutputs.end());
+  if (!append)
+    found = myOutputs.emplace(tag, Output()).first;
+  Output &output = found->second;
+  if (!output.mille)
+  {
+    if (myNumOpen >= myMaxOpen)
+      closeLeastRecentlyUsed();
+    output.mille = std::make_unique<Mille>(fileName(tag).c_str(), myAsBinary, myWriteZero, append);
+    ++myNumOpen;
+  }
+  output.lastUse = ++myUseCount;
+  return *output.mille;
+}
+
+/// Close all outputs and write the steering file of every tagged output.
+/** Further \c get() calls would truncate the files again. */
+void MilleRouter::close()
+{
+  for (auto &[tag, output] : myOutputs)
+  {
+    output.mille.reset();
+    if (!tag.empty())
+      writeSteering(tag);
+  }
+  myOutputs.clear();
+  myNumOpen = 0;
+}
+
+/// Mille file name of a tag.
+std::string MilleRouter::fileName(const std::string &tag) const
+{
+  if (tag.empty())
+    return myOutBase + myExtension;
+  return myOutBase + "_" + tag + myExtension;
+}
+
+/// Mille file names of all outputs created so far.
+std::vector<std::string> MilleRouter::fileNames() const
+{
+  std::vector<std::string> names;
+  for (const auto &[tag, output] : myOutputs)
+    names.push_back(fileName(tag));
+  return names;
+}
+
+void MilleRouter::closeLeastRecentlyUsed()
+{
+  Output *oldest = nullptr;
+  for (auto &[tag, output] : myOutputs)
+  {
+    if (output.mille && (!oldest || output.lastUse < oldest->lastUse))
+      oldest = &output;
+  }
+  if (oldest)
+  {
+    oldest->mille.reset();
+    --myNumOpen;
+  }
+}
+
+/// Steering file pointing pede to the Mille file of the tag.
+void MilleRouter::writeSteering(const std::string &tag) const
+{
+  const std::string binName = std::filesystem::path(fileName(tag)).filename().string();
+  const std::string steerName = myOutBase + "_" + tag + "_str.txt";
+  std::ofstream steer(steerName);
+  if (!steer.is_open())
+  {
+    std::cerr << "MilleRouter::writeSteering: Could not open " << steerName
+              << " as output file." << std::endl;
+    return;
+  }
+
+  if (mySteeringTemplate.empty())
+  {
+    steer << "Cfiles       ! following bin files are Cfiles\n"
+          << binName << "   ! binary data file\n";
+    return;
+  }
+
+  std::ifstream in(mySteeringTemplate);
+  if (!in.is_open())
+  {
+    std::cerr << "MilleRouter::writeSteering: Could not open steering template "
+              << mySteeringTemplate << std::endl;
+    return;
+  }
+  // 把模板中的 .bin 文件行替换为当前分区的文件
+  std::string line;
+  while (std::getline(in, line))
+  {
+    std::istringstream words(line);
+    std::string first;
+    words >> first;
+    if (first.size() > 4 && first.compare(first.size() - 4, 4, ".bin") == 0)
+      steer << binName << "   ! binary data file\n";
+    else
+      steer << line << "\n";
+  }
+}
@@ -0,0 +1,129 @@
+#include "Monitor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+Histogram1D::Histogram1D(int nBins, double low, double high)
+    : low(low), high(high), bins(nBins + 2, 0)
+{
+}
+
+void Histogram1D::fill(double value)
+{
+  const int nBins = bins.size() - 2;
+  if (!(value >= low)) // also NaN
+    ++bins.front();
+  else if (value >= high)
+    ++bins.back();
+  else
+    ++bins[1 + std::min(static_cast<int>((value - low) / (high - low) * nBins), nBins - 1)];
+}
+
+/// Add the bin contents of a histogram with the same binning.
+void Histogram1D::merge(const Histogram1D &other)
+{
+  for (size_t i = 0; i < bins.size() && i < other.bins.size(); ++i)
+    bins[i] += other.bins[i];
+}
+
+//___________________________________________________________________________
+
+/// Binning follows the 1convert cuts: |residual| < 0.05 and 100 < pz < 5000.
+/// |p| is not bounded by the pz cut, its range is doubled for the transverse part.
+Monitor::Monitor()
+    : myResidual(100, -0.05, 0.05), myPull(100, -10., 10.), myDerivative(100, -1.5, 1.5),
+      myMomentum(200, 0., 10000.), myMomentumZ(100, 0., 5000.)
+{
+}
+
+/// Fill one track with at least one written measurement.
+void Monitor::fillTrack(float px, float py, float pz)
+{
+  myMomentum.fill(std::sqrt(px * px + py * py + pz * pz));
+  myMomentumZ.fill(pz);
+}
+
+/// Fill one written measurement, a label <= 0 is not counted.
+/**
+ * \param[in] derivative  global derivative of the residual by the module x shift
+ */
+void Monitor::fillHit(float residual, float sigma, float derivative, int moduleLabel, int layerLabel, int stationLabel)
+{
+  myResidual.fill(residual);
+  if (sigma > 0)
+    myPull.fill(residual / sigma);
+  myDerivative.fill(derivative);
+  if (moduleLabel > 0)
+    ++myModuleHits[moduleLabel];
+  if (layerLabel > 0)
+    ++myLayerHits[layerLabel];
+  if (stationLabel > 0)
+    ++myStationHits[stationLabel];
+}
+
+void Monitor::merge(const Monitor &other)
+{
+  myResidual.merge(other.myResidual);
+  myPull.merge(other.myPull);
+  myDerivative.merge(other.myDerivative);
+  myMomentum.merge(other.myMomentum);
+  myMomentumZ.merge(other.myMomentumZ);
+  for (const auto &[label, n] : other.myModuleHits)
+    myModuleHits[label] += n;
+  for (const auto &[label, n] : other.myLayerHits)
+    myLayerHits[label] += n;
+  for (const auto &[label, n] : other.myStationHits)
+    myStationHits[label] += n;
+}
+
+/// Write all histograms as CSV: name,index,low,high,entries.
+/**
+ * Histogram rows use index 0 for the underflow and n+1 for the overflow,
+ * hit count rows use the label as index and leave low/high empty.
+ */
+bool Monitor::write(const std::string &fileName) const
+{
+  std::ofstream out(fileName);
+  if (!out.is_open())
+  {
+    std::cerr << "Monitor::write: Could not open " << fileName
+              << " as output file." << std::endl;
+    return false;
+  }
+  out << "name,index,low,high,entries\n";
+  auto writeHistogram = [&out](const char *name, const Histogram1D &hist)
+  {
+    const int nBins = hist.bins.size() - 2;
+    const double width = (hist.high - hist.low) / nBins;
+    for (int i = 0; i < nBins + 2; ++i)
+    {
+      out << name << "," << i << ",";
+      if (i > 0)
+        out << hist.low + (i - 1) * width;
+      else
+        out << "-inf";
+      out << ",";
+      if (i <= nBins)
+        out << hist.low + i * width;
+      else
+        out << "inf";
+      out << "," << hist.bins[i] << "\n";
+    }
+  };
+  auto writeCounts = [&out](const char *name, const std::map<int, unsigned long long> &counts)
+  {
+    for (const auto &[label, n] : counts)
+      out << name << "," << label << ",,," << n << "\n";
+  };
+  writeHistogram("residual_x", myResidual);
+  writeHistogram("pull_x", myPull);
+  writeHistogram("derivative_x", myDerivative);
+  writeHistogram("momentum", myMomentum);
+  writeHistogram("momentum_z", myMomentumZ);
+  writeCounts("hits_module", myModuleHits);
+  writeCounts("hits_layer", myLayerHits);
+  writeCounts("hits_station", myStationHits);
+  return true;
+}
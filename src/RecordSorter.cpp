@@ -0,0 +1,247 @@
+#include "RecordSorter.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <vector>
+
+namespace
+{
+  /// Runs merged at once, bounds the number of open files.
+  const std::size_t kMaxMergeRuns = 64;
+
+  /// Read one record (word count and payload) into buffer.
+  /**
+   * \return false at the end of the file or on a broken record, which also sets broken
+   */
+  bool readRecord(std::ifstream &in, std::vector<char> &buffer, bool &broken)
+  {
+    int nWords = 0;
+    if (!in.read(reinterpret_cast<char *>(&nWords), sizeof(nWords)))
+      return false;
+    if (nWords <= 0 || nWords % 2 != 0)
+    {
+      std::cerr << "RecordSorter: Invalid record length " << nWords << std::endl;
+      broken = true;
+      return false;
+    }
+    buffer.resize(sizeof(nWords) + nWords * sizeof(int));
+    std::memcpy(buffer.data(), &nWords, sizeof(nWords));
+    if (!in.read(buffer.data() + sizeof(nWords), nWords * sizeof(int)))
+    {
+      std::cerr << "RecordSorter: Truncated record" << std::endl;
+      broken = true;
+      return false;
+    }
+    return true;
+  }
+
+  RecordSorter::Key recordKey(const char *record)
+  {
+    int nWords = 0;
+    std::memcpy(&nWords, record, sizeof(nWords));
+    const float *floats = reinterpret_cast<const float *>(record + sizeof(nWords));
+    const int *ints = reinterpret_cast<const int *>(record + sizeof(nWords) + nWords / 2 * sizeof(float));
+    return RecordSorter::key(floats, ints, nWords);
+  }
+
+  /// Merge sorted runs into outName, ties go to the earlier run to keep the input order.
+  /**
+   * \param[out] changes  signature changes in the merged file
+   * \return     false if a run is broken or outName could not be written
+   */
+  bool mergeRuns(const std::vector<std::string> &runNames, const std::string &outName,
+                 std::uint64_t &changes)
+  {
+    std::vector<std::ifstream> runs;
+    std::vector<std::vector<char>> heads(runNames.size());
+    using Head = std::pair<RecordSorter::Key, std::size_t>;
+    auto later = [](const Head &a, const Head &b)
+    { return b.first < a.first || (a.first == b.first && a.second > b.second); };
+    std::priority_queue<Head, std::vector<Head>, decltype(later)> queue(later);
+    bool broken = false;
+    for (std::size_t r = 0; r < runNames.size(); ++r)
+    {
+      runs.emplace_back(runNames[r], std::ios::binary);
+      if (readRecord(runs[r], heads[r], broken))
+        queue.push({recordKey(heads[r].data()), r});
+    }
+    std::ofstream out(outName, std::ios::binary);
+    RecordSorter::Key previous;
+    bool first = true;
+    changes = 0;
+    while (!queue.empty())
+    {
+      auto [key, r] = queue.top();
+      queue.pop();
+      if (!first && key.signature != previous.signature)
+        ++changes;
+      previous = key;
+      first = false;
+      out.write(heads[r].data(), heads[r].size());
+      if (readRecord(runs[r], heads[r], broken))
+        queue.push({recordKey(heads[r].data()), r});
+    }
+    if (!out || broken)
+    {
+      std::cerr << "RecordSorter::sort: Could not write " << outName << std::endl;
+      return false;
+    }
+    return true;
+  }
+}
+
+/// \param[in] memoryBytes  size of the records sorted in memory at once
+RecordSorter::RecordSorter(std::size_t memoryBytes) : myMemoryBytes(memoryBytes)
+{
+}
+
+/// Layer signature and smallest module label of a record.
+/**
+ * \param[in] floats  float words of the record
+ * \param[in] ints    int words of the record
+ * \param[in] nWords  number of words as written in front of the record
+ */
+RecordSorter::Key RecordSorter::key(const float *floats, const int *ints, int nWords)
+{
+  Key key;
+  const int n = nWords / 2;
+  int i = 1; // position 0 is the error counter
+  while (i < n)
+  {
+    // special data: (0., 0) then (-nSpecial, 0) and nSpecial pairs
+    if (ints[i] == 0 && floats[i] == 0 && i + 1 < n && ints[i + 1] == 0 && floats[i + 1] < 0)
+    {
+      i += 2 + static_cast<int>(-floats[i + 1]);
+      continue;
+    }
+    ++i; // measurement
+    while (i < n && ints[i] != 0) // local derivatives
+      ++i;
+    ++i; // sigma
+    for (; i < n && ints[i] != 0; ++i) // global derivatives
+    {
+      const int label = ints[i];
+      int layer;
+      if (label >= 10000) // module: moduleid * 10 + k
+      {
+        layer = label / 1000;
+        if (key.firstModule == 0 || label < key.firstModule)
+          key.firstModule = label;
+      }
+      else if (label >= 100) // layer: layerid * 10 + k
+        layer = label / 10;
+      else // station: stationid * 10 + k, below the layer and module bits
+        layer = label / 10;
+      key.signature |= std::uint64_t(1) << (layer % 64);
+    }
+  }
+  return key;
+}
+
+/// Sort the records of a binary Mille file in place.
+/**
+ * \param[in] fileName  binary Mille file
+ * \return    false if the file could not be read or written, it is then unchanged
+ */
+bool RecordSorter::sort(const std::string &fileName)
+{
+  myNumRecords = myNumRuns = myChangesBefore = myChangesAfter = 0;
+  std::ifstream in(fileName, std::ios::binary);
+  if (!in.is_open())
+  {
+    std::cerr << "RecordSorter::sort: Could not open " << fileName << std::endl;
+    return false;
+  }
+
+  struct Entry
+  {
+    Key key;
+    std::size_t offset;
+    std::size_t size;
+  };
+  std::vector<char> pool;
+  std::vector<Entry> entries;
+  std::vector<char> record;
+  std::vector<std::string> runNames;
+  Key previous;
+  bool ok = true;
+  bool broken = false;
+
+  // 1. sorted runs of at most myMemoryBytes, the pool is allocated once
+  in.seekg(0, std::ios::end);
+  const std::streamoff fileSize = in.tellg();
+  in.seekg(0, std::ios::beg);
+  pool.reserve(std::min(myMemoryBytes, static_cast<std::size_t>(std::max<std::streamoff>(fileSize, 0))));
+  std::vector<std::string> allRuns; // every run file, removed at the end
+  auto writeRun = [&]()
+  {
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const Entry &a, const Entry &b) { return a.key < b.key; });
+    runNames.push_back(fileName + ".run" + std::to_string(allRuns.size()));
+    allRuns.push_back(runNames.back());
+    std::ofstream run(runNames.back(), std::ios::binary);
+    for (const Entry &entry : entries)
+      run.write(pool.data() + entry.offset, entry.size);
+    if (!run)
+    {
+      std::cerr << "RecordSorter::sort: Could not write " << runNames.back() << std::endl;
+      ok = false;
+    }
+    pool.clear();
+    entries.clear();
+  };
+  while (ok && readRecord(in, record, broken))
+  {
+    Key key = recordKey(record.data());
+    if (myNumRecords > 0 && key.signature != previous.signature)
+      ++myChangesBefore;
+    previous = key;
+    ++myNumRecords;
+    if (!entries.empty() && pool.size() + record.size() > myMemoryBytes)
+      writeRun();
+    entries.push_back({key, pool.size(), record.size()});
+    pool.insert(pool.end(), record.begin(), record.end());
+  }
+  if (broken)
+    ok = false;
+  in.close();
+  if (ok && !entries.empty())
+    writeRun();
+  std::vector<char>().swap(pool);
+  myNumRuns = runNames.size();
+
+  // 2. merge at most kMaxMergeRuns consecutive runs at a time until one pass is left
+  while (ok && runNames.size() > kMaxMergeRuns)
+  {
+    std::vector<std::string> merged;
+    for (std::size_t first = 0; ok && first < runNames.size(); first += kMaxMergeRuns)
+    {
+      const std::size_t last = std::min(first + kMaxMergeRuns, runNames.size());
+      const std::vector<std::string> group(runNames.begin() + first, runNames.begin() + last);
+      merged.push_back(fileName + ".run" + std::to_string(allRuns.size()));
+      allRuns.push_back(merged.back());
+      std::uint64_t changes = 0;
+      ok = mergeRuns(group, merged.back(), changes);
+      for (const std::string &name : group)
+        std::remove(name.c_str());
+    }
+    runNames.swap(merged);
+  }
+  const std::string sortedName = fileName + ".sorted";
+  if (ok)
+    ok = mergeRuns(runNames, sortedName, myChangesAfter);
+
+  for (const std::string &name : allRuns)
+    std::remove(name.c_str());
+  if (!ok || std::rename(sortedName.c_str(), fileName.c_str()) != 0)
+  {
+    std::remove(sortedName.c_str());
+    std::cerr << "RecordSorter::sort: " << fileName << " left unsorted" << std::endl;
+    return false;
+  }
+  return true;
+}
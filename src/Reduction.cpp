@@ -0,0 +1,111 @@
+#include "Reduction.hpp"
+
+#include <cstring>
+
+namespace
+{
+  /// FNV-1a over the bytes of a 32 bit word.
+  void hashWord(std::uint64_t &hash, std::uint32_t word)
+  {
+    for (int i = 0; i < 4; ++i)
+    {
+      hash ^= (word >> (8 * i)) & 0xff;
+      hash *= 0x100000001b3ULL;
+    }
+  }
+
+  void hashFloat(std::uint64_t &hash, float value)
+  {
+    if (value == 0)
+      value = 0; // -0 and +0 give the same fingerprint
+    std::uint32_t word;
+    std::memcpy(&word, &value, sizeof(word));
+    hashWord(hash, word);
+  }
+}
+
+std::uint64_t trackFingerprint(const TrackView &track)
+{
+  std::uint64_t hash = 0xcbf29ce484222325ULL;
+  const TrackInfo &info = track.info;
+  hashFloat(hash, info.x);
+  hashFloat(hash, info.y);
+  hashFloat(hash, info.px);
+  hashFloat(hash, info.py);
+  hashFloat(hash, info.pz);
+  hashFloat(hash, info.charge);
+  for (int ihit = 0; ihit < track.nHits; ++ihit)
+    hashWord(hash, static_cast<std::uint32_t>(track.id[ihit]));
+
+  // splitmix64 finalizer, FNV alone leaves the high bits poorly mixed
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebULL;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+bool Prescaler::keep(const TrackView &track) const
+{
+  if (!enabled())
+    return true;
+  // top 53 bits as a double in [0, 1)
+  return (trackFingerprint(track) >> 11) * 0x1.0p-53 < myFraction;
+}
+
+bool OccupancyCap::full(int label) const
+{
+  if (!enabled())
+    return false;
+  auto found = myHits.find(label);
+  return found != myHits.end() && found->second >= myMaxHits;
+}
+
+//___________________________________________________________________________
+
+FingerprintSet::FingerprintSet() : mySlots(1 << 16, 0)
+{
+}
+
+/// Add a fingerprint.
+/**
+ * \return false if it was already in the set, i.e. the track is a duplicate
+ */
+bool FingerprintSet::insert(std::uint64_t fingerprint)
+{
+  if (fingerprint == 0)
+    fingerprint = 1; // 0 marks an empty slot
+  if ((mySize + 1) * 4 > mySlots.size() * 3)
+    grow();
+  const std::size_t mask = mySlots.size() - 1;
+  // fingerprints are already well mixed, use them directly as slot index
+  for (std::size_t i = fingerprint & mask;; i = (i + 1) & mask)
+  {
+    if (mySlots[i] == fingerprint)
+      return false;
+    if (mySlots[i] == 0)
+    {
+      mySlots[i] = fingerprint;
+      ++mySize;
+      return true;
+    }
+  }
+}
+
+/// Double the number of slots and reinsert.
+void FingerprintSet::grow()
+{
+  std::vector<std::uint64_t> old(mySlots.size() * 2, 0);
+  old.swap(mySlots);
+  const std::size_t mask = mySlots.size() - 1;
+  for (std::uint64_t fingerprint : old)
+  {
+    if (fingerprint == 0)
+      continue;
+    std::size_t i = fingerprint & mask;
+    while (mySlots[i] != 0)
+      i = (i + 1) & mask;
+    mySlots[i] = fingerprint;
+  }
+}
@@ -0,0 +1,160 @@
+#include "TrackRefit.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+  const double kHuberC = 1.345;
+  const double kCauchyC = 2.3849;
+
+  /// Solve the symmetric system N x = b by Cholesky decomposition, in place.
+  /**
+   * Parameters without sensitivity (vanishing pivot) are fixed at 0.
+   * \param[in,out] N  n x n matrix, destroyed
+   * \param[in,out] b  right hand side, replaced by the solution
+   */
+  void solve(std::vector<double> &N, std::vector<double> &b, int n)
+  {
+    std::vector<bool> fixed(n, false);
+    for (int j = 0; j < n; ++j)
+    {
+      const double scale = N[j * n + j];
+      double diag = scale;
+      for (int k = 0; k < j; ++k)
+        diag -= N[j * n + k] * N[j * n + k];
+      if (!(diag > 1e-12 * scale) || scale <= 0)
+      {
+        fixed[j] = true;
+        for (int k = 0; k < n; ++k)
+          N[j * n + k] = N[k * n + j] = 0;
+        N[j * n + j] = 1;
+        continue;
+      }
+      const double pivot = std::sqrt(diag);
+      N[j * n + j] = pivot;
+      for (int i = j + 1; i < n; ++i)
+      {
+        double sum = N[i * n + j];
+        for (int k = 0; k < j; ++k)
+          sum -= N[i * n + k] * N[j * n + k];
+        N[i * n + j] = sum / pivot;
+      }
+    }
+    for (int i = 0; i < n; ++i) // forward: L y = b
+    {
+      if (fixed[i])
+      {
+        b[i] = 0;
+        continue;
+      }
+      for (int k = 0; k < i; ++k)
+        b[i] -= N[i * n + k] * b[k];
+      b[i] /= N[i * n + i];
+    }
+    for (int i = n - 1; i >= 0; --i) // backward: L^T x = y
+    {
+      if (fixed[i])
+        continue;
+      for (int k = i + 1; k < n; ++k)
+        b[i] -= N[k * n + i] * b[k];
+      b[i] /= N[i * n + i];
+    }
+  }
+}
+
+/// \param[in] estimator      M-estimator
+/// \param[in] minWeight      measurements with a smaller final weight are dropped
+/// \param[in] maxIterations  maximum number of reweighting iterations
+TrackRefit::TrackRefit(Estimator estimator, double minWeight, int maxIterations)
+    : myEstimator(estimator), myMinWeight(minWeight), myMaxIterations(maxIterations)
+{
+}
+
+/// Estimator from its name: "huber", "cauchy" or "" for none.
+bool TrackRefit::parse(const std::string &name, Estimator &estimator)
+{
+  if (name == "")
+    estimator = kNone;
+  else if (name == "huber")
+    estimator = kHuber;
+  else if (name == "cauchy")
+    estimator = kCauchy;
+  else
+    return false;
+  return true;
+}
+
+double TrackRefit::weight(double t) const
+{
+  const double a = std::fabs(t);
+  switch (myEstimator)
+  {
+  case kHuber:
+    return a <= kHuberC ? 1. : kHuberC / a;
+  case kCauchy:
+    return 1. / (1. + (t / kCauchyC) * (t / kCauchyC));
+  default:
+    return 1.;
+  }
+}
+
+/// Refit the local parameter corrections of one track and fill \c weights().
+/**
+ * \param[in]    nHit   number of measurements
+ * \param[in]    NLC    number of local derivatives per measurement
+ * \param[in]    derLc  local derivatives, nHit x NLC
+ * \param[in]    rMeas  measurements (residua), nHit
+ * \param[in]    sigma  errors, nHit
+ * \return       false if the track has no degrees of freedom, weights are then all 1
+ */
+bool TrackRefit::fit(int nHit, int NLC, const float *derLc, const float *rMeas, const float *sigma)
+{
+  myWeights.assign(nHit, 1.);
+  if (!enabled() || nHit <= NLC)
+    return false;
+
+  std::vector<double> N(NLC * NLC);
+  std::vector<double> b(NLC);
+  for (int iter = 0; iter < myMaxIterations; ++iter)
+  {
+    // weighted normal equations
+    std::fill(N.begin(), N.end(), 0.);
+    std::fill(b.begin(), b.end(), 0.);
+    for (int iHit = 0; iHit < nHit; ++iHit)
+    {
+      if (sigma[iHit] <= 0)
+        continue;
+      const float *a = derLc + iHit * NLC;
+      const double w = myWeights[iHit] / (double(sigma[iHit]) * sigma[iHit]);
+      for (int i = 0; i < NLC; ++i)
+      {
+        b[i] += w * a[i] * rMeas[iHit];
+        for (int j = 0; j <= i; ++j)
+          N[i * NLC + j] += w * a[i] * a[j];
+      }
+    }
+    for (int i = 0; i < NLC; ++i)
+      for (int j = 0; j < i; ++j)
+        N[j * NLC + i] = N[i * NLC + j];
+    solve(N, b, NLC);
+
+    // new weights from the normalised residuals
+    double change = 0;
+    for (int iHit = 0; iHit < nHit; ++iHit)
+    {
+      if (sigma[iHit] <= 0)
+        continue;
+      const float *a = derLc + iHit * NLC;
+      double r = rMeas[iHit];
+      for (int i = 0; i < NLC; ++i)
+        r -= a[i] * b[i];
+      const double w = weight(r / sigma[iHit]);
+      change = std::max(change, std::fabs(w - myWeights[iHit]));
+      myWeights[iHit] = w;
+    }
+    if (change < 1e-3)
+      break;
+  }
+  return true;
+}
@@ -7,22 +7,65 @@
 #include <string>
 #include <filesystem>
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <regex>
 
 // root
 #include <TFile.h>
 #include <TTree.h>
+#include <TLeaf.h>
 
 // submodule
 #include <argparse/argparse.hpp>
 
 // local
+#include "HitCache.hpp"
 #include "Mille.hpp"
+#include "MilleRouter.hpp"
+#include "Monitor.hpp"
+#include "RecordSorter.hpp"
+#include "Reduction.hpp"
+#include "TrackRefit.hpp"
+#include "Track.hpp"
 
 using std::cout;
 using std::endl;
 using std::string;
 using std::vector;
 
+// 用来控制 Track 中对 Hits 循环的条件表达式的选择
+const bool dump6ndf_modules = false;
+const bool dumplayers = true;
+const bool dump6ndf_layers = true;
+const bool dumpz_layers = false;
+const bool dumpstations = false;
+const bool dump6ndf_stations = true;
+const bool use_sidebyside = true;
+
+// 从文件路径中解析 run number（如 .../run010738/...），找不到时返回 -1
+// 只匹配完整的目录名或文件名主干，避免 "Run3"、"rerun2" 之类被误认
+long long runFromPath(const string &path)
+{
+  static const std::regex runPattern("run_?([0-9]{1,18})");
+  long long run = -1;
+  const std::filesystem::path file(path);
+  for (const auto &component : file.parent_path())
+  {
+    std::smatch match;
+    const string name = component.string();
+    if (std::regex_match(name, match, runPattern))
+      run = std::stoll(match[1].str());
+  }
+  std::smatch match;
+  const string stem = file.stem().string();
+  if (std::regex_match(stem, match, runPattern))
+    run = std::stoll(match[1].str());
+  return run;
+}
+
 int main(int argc, char *argv[])
 {
   // ArgParse
@@ -31,7 +74,7 @@ int main(int argc, char *argv[])
       .required()
       .help("specify the output file.");
   program.add_argument("-i", "--input")
-      .required()
+      .default_value(string(""))
       .help("specify the input directory.");
   program.add_argument("-t", "--text")
       .default_value(false)
@@ -41,6 +84,56 @@ int main(int argc, char *argv[])
       .default_value(false)
       .implicit_value(true)
       .help("write zero data (default: false)");
+  program.add_argument("-p", "--partition")
+      .default_value(string(""))
+      .help("split the output by \"run\" or by \"time\" window, one Mille and steering file each");
+  program.add_argument("--window")
+      .default_value(3600)
+      .scan<'i', int>()
+      .help("length of a time window in seconds for --partition time (default: 3600)");
+  program.add_argument("--max-open")
+      .default_value(64)
+      .scan<'i', int>()
+      .help("maximum number of simultaneously open output files (default: 64)");
+  program.add_argument("--steering")
+      .default_value(string(""))
+      .help("steering file template copied for every partition, its .bin line is replaced");
+  program.add_argument("--write-cache")
+      .default_value(string(""))
+      .help("also save all tracks with their hits passing the sentinel check to this hit cache file");
+  program.add_argument("--from-cache")
+      .default_value(string(""))
+      .help("read the hits from this hit cache file instead of the ROOT files of --input");
+  program.add_argument("-m", "--monitor")
+      .default_value(string(""))
+      .help("write residual, pull, derivative, momentum, pz and hits per label histograms to this CSV file");
+  program.add_argument("--prescale")
+      .default_value(1.)
+      .scan<'g', double>()
+      .help("keep this fraction of the tracks, chosen by a hash of the track (default: 1)");
+  program.add_argument("--max-hits")
+      .default_value(0)
+      .scan<'i', int>()
+      .help("stop writing hits of a module to an output file once it has this many, 0 for no cap (default: 0)");
+  program.add_argument("-d", "--dedup")
+      .default_value(false)
+      .implicit_value(true)
+      .help("drop tracks already seen, e.g. from overlapping input files (default: false)");
+  program.add_argument("-w", "--downweight")
+      .default_value(string(""))
+      .help("refit the local track parameters with a \"huber\" or \"cauchy\" M-estimator, scale sigma by 1/sqrt(weight)");
+  program.add_argument("--downweight-cut")
+      .default_value(0.1)
+      .scan<'g', double>()
+      .help("drop measurements whose refit weight is below this value (default: 0.1)");
+  program.add_argument("-s", "--sort")
+      .default_value(false)
+      .implicit_value(true)
+      .help("reorder the records by the layers they touch for faster matrix building in pede (default: false)");
+  program.add_argument("--sort-memory")
+      .default_value(1024)
+      .scan<'i', int>()
+      .help("memory in MB for sorting the records, larger outputs are sorted in runs on disk (default: 1024)");
   try
   {
     program.parse_args(argc, argv);
@@ -56,17 +149,75 @@ int main(int argc, char *argv[])
   auto zero = program.get<bool>("--zero");
   auto input = program.get<string>("--input");
   auto output = program.get<string>("--output");
-  if (text)
+  auto partition = program.get<string>("--partition");
+  auto window = program.get<int>("--window");
+  auto max_open = program.get<int>("--max-open");
+  auto steering = program.get<string>("--steering");
+  auto write_cache = program.get<string>("--write-cache");
+  auto from_cache = program.get<string>("--from-cache");
+  auto monitor_file = program.get<string>("--monitor");
+  bool monitoring = (monitor_file != "");
+  auto prescale = program.get<double>("--prescale");
+  auto max_hits = program.get<int>("--max-hits");
+  auto dedup = program.get<bool>("--dedup");
+  auto downweight = program.get<string>("--downweight");
+  auto downweight_cut = program.get<double>("--downweight-cut");
+  auto sort = program.get<bool>("--sort");
+  auto sort_memory = program.get<int>("--sort-memory");
+  if ((input == "") == (from_cache == ""))
   {
-    output += ".txt";
+    std::cerr << "Specify exactly one of --input and --from-cache" << std::endl;
+    std::cerr << program;
+    std::exit(1);
   }
-  else
+  if (from_cache != "" && write_cache != "")
+  {
+    std::cerr << "--write-cache needs ROOT input, not --from-cache" << std::endl;
+    std::exit(1);
+  }
+  if (prescale <= 0 || prescale > 1 || max_hits < 0)
+  {
+    std::cerr << "Prescale must be in (0, 1] and max hits non-negative" << std::endl;
+    std::exit(1);
+  }
+  TrackRefit::Estimator estimator;
+  if (!TrackRefit::parse(downweight, estimator))
   {
-    output += ".bin";
+    std::cerr << "Unknown M-estimator " << downweight << ", use \"huber\" or \"cauchy\"" << std::endl;
+    std::exit(1);
+  }
+  if (sort && text)
+  {
+    std::cerr << "--sort needs binary output" << std::endl;
+    std::exit(1);
+  }
+  if (sort && sort_memory <= 0)
+  {
+    std::cerr << "Sort memory must be positive: " << sort_memory << std::endl;
+    std::exit(1);
+  }
+  if (partition != "" && partition != "run" && partition != "time")
+  {
+    std::cerr << "Unknown partition " << partition << ", use \"run\" or \"time\"" << std::endl;
+    std::exit(1);
   }
+  if (max_open <= 0)
+  {
+    std::cerr << "Maximum number of open files must be positive: " << max_open << std::endl;
+    std::exit(1);
+  }
+  if (partition == "time" && window <= 0)
+  {
+    std::cerr << "Time window must be positive: " << window << std::endl;
+    std::exit(1);
+  }
+  string extension = text ? ".txt" : ".bin";
 
   // data23
-  Mille mille_file(output.c_str(), binary, zero);
+  MilleRouter mille_files(output, extension, binary, zero, max_open, steering);
+  // 不分区时立即创建（清空）输出，避免没有 track 时留下上次的旧文件
+  if (partition == "")
+    mille_files.get("");
   // data22
   // TFile* f1=new TFile("/afs/cern.ch/user/k/keli/eos/Faser/alignment/global/8023_8025_8115_8301_8730_9073/kfalignment_data_iter5_noIFT_noZ.root");
   // Mille mille_file("/afs/cern.ch/user/k/keli/eos/Faser/alignment/global/8023_8025_8115_8301_8730_9073/mp2input.bin");
@@ -78,283 +229,524 @@ int main(int argc, char *argv[])
   // TFile* f1=new TFile("/afs/cern.ch/user/k/keli/eos/Faser/alignment/global/misalign_MC/inputformp2_iter0.root");
   // Mille mille_file("/afs/cern.ch/user/k/keli/eos/Faser/alignment/global/misalign_MC/mp2input.bin");
 
-  // 获取目录中所有的 ROOT 文件
-  vector<string> rootFiles;
-  try
+  // loop over all the events
+  // 整条 track 的数据，每个 hit 一行，交给 Mille::milleTrack 一次写入
+  std::vector<int> labels;
+  std::vector<float> glo_der;
+  std::vector<float> loc_der;
+  std::vector<float> resi;
+  std::vector<float> resi_e;
+  bool diffside = false;
+
+  int ioutput = 0;
+  // 数据量控制：按 hash 预缩放 track，按 module 限制 hit 数
+  // 每个输出文件（分区 tag）单独计数，前面的分区不会占满后面分区的 module
+  Prescaler prescaler(prescale);
+  std::map<string, OccupancyCap> occupancy_by_tag;
+  long long nprescaled = 0;
+  long long ncapped = 0;
+  // 去除重复的 track（如重复处理留下的重叠文件）
+  FingerprintSet seen;
+  long long nduplicates = 0;
+  // 用 local 导数重新拟合 track，对 outlier 降权或丢弃
+  TrackRefit refit(estimator, downweight_cut);
+  long long ndropped = 0;
+  long long ndownweighted = 0;
+  // 每个输入文件一个 Monitor，结束时合并
+  Monitor monitor;
+  Monitor monitor_total;
+  // 对一条 track 做 cut 并写出，ROOT 和 hit cache 两种输入共用
+  auto convert = [&](const TrackView &track)
   {
-    for (const auto &entry : std::filesystem::directory_iterator(input))
+    const TrackInfo &info = track.info;
+    const float *const *hit = track.hit;
+    // std::cout<<"like "<<ievt<<" "<<m_fitParam_chi2/m_fitParam_ndf<<" "<<m_fitParam_pz<<" "<<m_fitParam_align_id->size()<<std::endl;
+    if (info.chi2 > 2000 || info.pz < 100 || info.pz > 5000 || info.nRawHits < 15)
+      return;
+    // if(m_fitParam_chi2>500||m_fitParam_pz<100||m_fitParam_pz>5000||m_fitParam_align_id->size()<15)continue;
+    if (!prescaler.keep(track))
     {
-      if (entry.is_regular_file())
-      {
-        if (entry.path().extension().string() == ".root")
-        {
-          rootFiles.push_back(entry.path().string());
-        }
-      }
+      ++nprescaled;
+      return;
     }
-  }
-  catch (const std::filesystem::filesystem_error &ex)
-  {
-    std::cerr << "Error accessing directory " << input << ": " << ex.what() << std::endl;
-    return 1;
-  }
-  // 排序文件列表以确保处理顺序一致
-  std::sort(rootFiles.begin(), rootFiles.end());
-  cout << "Found " << rootFiles.size() << " ROOT files in " << input << endl;
-  cout << "Converting " << input << " to " << output << " ..." << endl;
+    if (dedup && !seen.insert(trackFingerprint(track)))
+    {
+      ++nduplicates;
+      return;
+    }
+    ++ioutput;
 
-  // 遍历所有找到的 ROOT 文件
-  for (size_t fileIndex = 0; fileIndex < rootFiles.size(); ++fileIndex)
-  {
-    const string &InputFileName = rootFiles[fileIndex];
-    cout << "Dealing with File " << fileIndex + 1 << "/" << rootFiles.size()
-         << ": " << InputFileName << " ..." << endl;
-    // if(fileId==29)continue;
-    // if(fileId==14)continue;
-    // if(fileId==31)continue;
-    // if(fileId==40)continue;
-
-    // 读取 tree 树
-    TFile *f1 = TFile::Open(InputFileName.c_str(), "READ");
-    if (!f1 || f1->IsZombie())
+    // 选择当前 track 写入的文件
+    string tag;
+    char buffer[32];
+    if (partition == "run")
     {
-      std::cerr << "Error: Cannot open file " << InputFileName << std::endl;
-      if (f1)
-        f1->Close();
-      continue; // 跳过这个文件，继续处理下一个
+      if (info.run < 0)
+        tag = "run_unknown";
+      else
+      {
+        std::snprintf(buffer, sizeof(buffer), "run%06lld", info.run);
+        tag = buffer;
+      }
     }
-    TTree *t1 = (TTree *)f1->Get("tree");
-    if (!t1)
+    else if (partition == "time")
     {
-      std::cerr << "Error: Cannot find tree 'tree' in " << InputFileName << std::endl;
-      f1->Close();
-      continue;
+      if (info.time < 0)
+        tag = "time_unknown";
+      else
+      {
+        std::snprintf(buffer, sizeof(buffer), "t%lld", info.time - info.time % window);
+        tag = buffer;
+      }
     }
+    Mille &mille_file = mille_files.get(tag);
+    OccupancyCap &occupancy = occupancy_by_tag.try_emplace(tag, max_hits).first->second;
 
-    // 用来控制 Track 中对 Hits 循环的条件表达式的选择
-    bool dump6ndf_modules = false;
-    bool dumplayers = true;
-    bool dump6ndf_layers = true;
-    bool dumpz_layers = false;
-    bool dumpstations = false;
-    bool dump6ndf_stations = true;
-    bool use_sidebyside = true;
-
-    // 存储 28 个 branches
-    double m_fitParam_x = 0;
-    double m_fitParam_y = 0;
-    double m_fitParam_chi2 = 0;
-    double m_fitParam_px = 0;
-    double m_fitParam_py = 0;
-    double m_fitParam_pz = 0;
-    double m_fitParam_charge = 0;
-    std::vector<double> *m_fitParam_align_global_derivation_y_x = 0;
-    std::vector<double> *m_fitParam_align_global_derivation_y_y = 0;
-    std::vector<double> *m_fitParam_align_global_derivation_y_z = 0;
-    std::vector<double> *m_fitParam_align_global_derivation_y_rx = 0;
-    std::vector<double> *m_fitParam_align_global_derivation_y_ry = 0;
-    std::vector<double> *m_fitParam_align_global_derivation_y_rz = 0;
-    std::vector<double> *m_fitParam_align_local_derivation_x_x = 0;
-    std::vector<double> *m_fitParam_align_local_derivation_x_y = 0;
-    std::vector<double> *m_fitParam_align_local_derivation_x_z = 0;
-    std::vector<double> *m_fitParam_align_local_derivation_x_rx = 0;
-    std::vector<double> *m_fitParam_align_local_derivation_x_ry = 0;
-    std::vector<double> *m_fitParam_align_local_derivation_x_rz = 0;
-    std::vector<double> *m_fitParam_align_local_residual_x = 0;
-    std::vector<double> *m_fitParam_align_local_measured_x = 0;
-    std::vector<double> *m_fitParam_align_local_measured_xe = 0;
-    std::vector<double> *m_fitParam_align_id = 0;
-    std::vector<double> *m_fitParam_align_local_derivation_x_par_x = 0;
-    std::vector<double> *m_fitParam_align_local_derivation_x_par_y = 0;
-    std::vector<double> *m_fitParam_align_local_derivation_x_par_theta = 0;
-    std::vector<double> *m_fitParam_align_local_derivation_x_par_phi = 0;
-    std::vector<double> *m_fitParam_align_local_derivation_x_par_qop = 0;
-    t1->SetBranchAddress("fitParam_x", &m_fitParam_x);
-    t1->SetBranchAddress("fitParam_y", &m_fitParam_y);
-    t1->SetBranchAddress("fitParam_chi2", &m_fitParam_chi2);
-    t1->SetBranchAddress("fitParam_px", &m_fitParam_px);
-    t1->SetBranchAddress("fitParam_py", &m_fitParam_py);
-    t1->SetBranchAddress("fitParam_pz", &m_fitParam_pz);
-    t1->SetBranchAddress("fitParam_charge", &m_fitParam_charge);
-    t1->SetBranchAddress("fitParam_align_global_derivation_y_x", &m_fitParam_align_global_derivation_y_x);
-    t1->SetBranchAddress("fitParam_align_global_derivation_y_y", &m_fitParam_align_global_derivation_y_y);
-    t1->SetBranchAddress("fitParam_align_global_derivation_y_z", &m_fitParam_align_global_derivation_y_z);
-    t1->SetBranchAddress("fitParam_align_global_derivation_y_rx", &m_fitParam_align_global_derivation_y_rx);
-    t1->SetBranchAddress("fitParam_align_global_derivation_y_ry", &m_fitParam_align_global_derivation_y_ry);
-    t1->SetBranchAddress("fitParam_align_global_derivation_y_rz", &m_fitParam_align_global_derivation_y_rz);
-    t1->SetBranchAddress("fitParam_align_local_derivation_x_x", &m_fitParam_align_local_derivation_x_x);
-    t1->SetBranchAddress("fitParam_align_local_derivation_x_y", &m_fitParam_align_local_derivation_x_y);
-    t1->SetBranchAddress("fitParam_align_local_derivation_x_z", &m_fitParam_align_local_derivation_x_z);
-    t1->SetBranchAddress("fitParam_align_local_derivation_x_rx", &m_fitParam_align_local_derivation_x_rx);
-    t1->SetBranchAddress("fitParam_align_local_derivation_x_ry", &m_fitParam_align_local_derivation_x_ry);
-    t1->SetBranchAddress("fitParam_align_local_derivation_x_rz", &m_fitParam_align_local_derivation_x_rz);
-    t1->SetBranchAddress("fitParam_align_local_residual_x", &m_fitParam_align_local_residual_x);
-    t1->SetBranchAddress("fitParam_align_local_measured_x", &m_fitParam_align_local_measured_x);
-    t1->SetBranchAddress("fitParam_align_local_measured_xe", &m_fitParam_align_local_measured_xe);
-    t1->SetBranchAddress("fitParam_align_id", &m_fitParam_align_id);
-    t1->SetBranchAddress("fitParam_align_local_derivation_x_par_x", &m_fitParam_align_local_derivation_x_par_x);
-    t1->SetBranchAddress("fitParam_align_local_derivation_x_par_y", &m_fitParam_align_local_derivation_x_par_y);
-    t1->SetBranchAddress("fitParam_align_local_derivation_x_par_theta", &m_fitParam_align_local_derivation_x_par_theta);
-    t1->SetBranchAddress("fitParam_align_local_derivation_x_par_phi", &m_fitParam_align_local_derivation_x_par_phi);
-    t1->SetBranchAddress("fitParam_align_local_derivation_x_par_qop", &m_fitParam_align_local_derivation_x_par_qop);
-
-    int nevt = t1->GetEntries();
-
-    // loop over all the events
-    std::vector<int> labels;
-    std::vector<float> glo_der;
-    std::vector<float> loc_der;
-    float resi = 0.;
-    float resi_e = 0.;
-    bool diffside = false;
-
-    int ioutput = 0;
-    int nhits[8] = {0};
-    for (int ievt = 0; ievt < nevt; ++ievt)
+    // loop over one track
+    labels.clear();
+    glo_der.clear();
+    loc_der.clear();
+    resi.clear();
+    resi_e.clear();
+    for (int ihit = 0; ihit < track.nHits; ++ihit)
     {
-      t1->GetEntry(ievt);
-      // std::cout<<"like "<<ievt<<" "<<m_fitParam_chi2/m_fitParam_ndf<<" "<<m_fitParam_pz<<" "<<m_fitParam_align_id->size()<<std::endl;
-      if (m_fitParam_chi2 > 2000 || m_fitParam_pz < 100 || m_fitParam_pz > 5000 || m_fitParam_align_id->size() < 15)
+      if (fabs(hit[kResidualX][ihit]) > 0.05)
+        continue;
+      if (dumplayers && dump6ndf_layers && (fabs(hit[kGlobalYRx][ihit]) > 2 || fabs(hit[kGlobalYRy][ihit]) > 2))
         continue;
-      // if(m_fitParam_chi2>500||m_fitParam_pz<100||m_fitParam_pz>5000||m_fitParam_align_id->size()<15)continue;
-      ++ioutput;
-      //    if(ioutput>1000)continue;
 
-      // loop over one track
-      for (int ihit = 0; ihit < m_fitParam_align_id->size(); ++ihit)
-      {
-        labels.clear();
-        glo_der.clear();
-        loc_der.clear();
-        if (fabs(m_fitParam_align_local_residual_x->at(ihit)) > 0.05)
-          continue;
-        if (m_fitParam_align_local_derivation_x_x->at(ihit) < -9000 || m_fitParam_align_local_derivation_x_rz->at(ihit) < -9000 || m_fitParam_align_global_derivation_y_x->at(ihit) < -9000 || m_fitParam_align_global_derivation_y_y->at(ihit) < -9000 || m_fitParam_align_global_derivation_y_z->at(ihit) < -9000 || m_fitParam_align_global_derivation_y_rx->at(ihit) < -9000 || m_fitParam_align_global_derivation_y_ry->at(ihit) < -9000 || m_fitParam_align_global_derivation_y_rz->at(ihit) < -9000)
-          continue;
+      int moduleid = track.id[ihit];
 
-        int moduleid = m_fitParam_align_id->at(ihit);
+      diffside = false;
+      if ((moduleid % 10 == 1) && (!use_sidebyside))
+        --moduleid;
+      moduleid += 1000; // station from 1 not 0
+
+      if (occupancy.full(moduleid * 10 + 1))
+      {
+        ++ncapped;
+        continue;
+      }
 
-        diffside = false;
-        if ((moduleid % 10 == 1) && (!use_sidebyside))
-          --moduleid;
-        moduleid += 1000; // station from 1 not 0
+      if (dump6ndf_modules)
+      {
+        if (use_sidebyside)
+        {
+          labels.push_back(moduleid * 10 + 0 + 1); // millepede can not have label at 0
+          labels.push_back(moduleid * 10 + 1 + 1);
+          glo_der.push_back(hit[kDerivationXX][ihit]);
+          glo_der.push_back(hit[kDerivationXY][ihit]);
+        }
+        else
+        {
+          labels.push_back(moduleid * 10 + 0 + 1); // millepede can not have label at 0
+          glo_der.push_back(hit[kDerivationXX][ihit]);
+        }
 
-        //	int layerid = moduleid/100;
-        //	if(moduleid/100==10){
-        //	  if(nhits[moduleid%100/10]>1000)continue;
-        //	  nhits[moduleid%100/10]+=1;
-        //	}
+        labels.push_back(moduleid * 10 + 2 + 1);
+        labels.push_back(moduleid * 10 + 3 + 1);
+        labels.push_back(moduleid * 10 + 4 + 1);
+        labels.push_back(moduleid * 10 + 5 + 1);
+        glo_der.push_back(hit[kDerivationXZ][ihit]);
+        glo_der.push_back(hit[kDerivationXRx][ihit]);
+        glo_der.push_back(hit[kDerivationXRy][ihit]);
+        glo_der.push_back(hit[kDerivationXRz][ihit]);
+      }
+      else
+      {
+        labels.push_back(moduleid * 10 + 0 + 1); // millepede can not have label at 0
+        labels.push_back(((moduleid / 10) * 10) * 10 + 1 + 1);
+        glo_der.push_back(hit[kDerivationXX][ihit]);
+        glo_der.push_back(hit[kDerivationXRz][ihit]);
+      }
 
-        if (dump6ndf_modules)
+      if (dumplayers)
+      {
+        int layerid = moduleid / 100;
+        //	std::cout<<"id "<<moduleid<<" "<<layerid<<std::endl;
+        if (dump6ndf_layers)
         {
-          if (use_sidebyside)
-          {
-            labels.push_back(moduleid * 10 + 0 + 1); // millepede can not have label at 0
-            labels.push_back(moduleid * 10 + 1 + 1);
-            glo_der.push_back(m_fitParam_align_local_derivation_x_x->at(ihit));
-            glo_der.push_back(m_fitParam_align_local_derivation_x_y->at(ihit));
-          }
-          else
+          labels.push_back(layerid * 10 + 0 + 1); // millepede can not have label at 0
+          labels.push_back(layerid * 10 + 1 + 1);
+          labels.push_back(layerid * 10 + 2 + 1);
+          labels.push_back(layerid * 10 + 3 + 1);
+          labels.push_back(layerid * 10 + 4 + 1);
+          glo_der.push_back(hit[kGlobalYX][ihit]);
+          glo_der.push_back(hit[kGlobalYY][ihit]);
+          if (dumpz_layers)
           {
-            labels.push_back(moduleid * 10 + 0 + 1); // millepede can not have label at 0
-            glo_der.push_back(m_fitParam_align_local_derivation_x_x->at(ihit));
+            labels.push_back(layerid * 10 + 5 + 1);
+            glo_der.push_back(hit[kGlobalYZ][ihit]);
           }
+          glo_der.push_back(hit[kGlobalYRx][ihit]);
+          glo_der.push_back(hit[kGlobalYRy][ihit]);
+          glo_der.push_back(hit[kGlobalYRz][ihit]);
+        }
+        else
+        {
+          labels.push_back(layerid * 10 + 0 + 1); // millepede can not have label at 0
+          labels.push_back(layerid * 10 + 1 + 1);
+          glo_der.push_back(hit[kGlobalYY][ihit]);
+          glo_der.push_back(hit[kGlobalYRz][ihit]);
+        }
+      }
 
-          labels.push_back(moduleid * 10 + 2 + 1);
-          labels.push_back(moduleid * 10 + 3 + 1);
-          labels.push_back(moduleid * 10 + 4 + 1);
-          labels.push_back(moduleid * 10 + 5 + 1);
-          glo_der.push_back(m_fitParam_align_local_derivation_x_z->at(ihit));
-          glo_der.push_back(m_fitParam_align_local_derivation_x_rx->at(ihit));
-          glo_der.push_back(m_fitParam_align_local_derivation_x_ry->at(ihit));
-          glo_der.push_back(m_fitParam_align_local_derivation_x_rz->at(ihit));
+      if (dumpstations)
+      {
+        int stationid = moduleid / 1000;
+        if (dump6ndf_stations)
+        {
+          labels.push_back(stationid * 10 + 0 + 1); // millepede can not have label at 0
+          labels.push_back(stationid * 10 + 1 + 1);
+          labels.push_back(stationid * 10 + 2 + 1);
+          labels.push_back(stationid * 10 + 3 + 1);
+          labels.push_back(stationid * 10 + 4 + 1);
+          labels.push_back(stationid * 10 + 5 + 1);
+          glo_der.push_back(hit[kGlobalYX][ihit]);
+          glo_der.push_back(hit[kGlobalYY][ihit]);
+          glo_der.push_back(hit[kGlobalYZ][ihit]);
+          glo_der.push_back(hit[kGlobalYRx][ihit]);
+          glo_der.push_back(hit[kGlobalYRy][ihit]);
+          glo_der.push_back(hit[kGlobalYRz][ihit]);
         }
         else
         {
-          labels.push_back(moduleid * 10 + 0 + 1); // millepede can not have label at 0
-          labels.push_back(((moduleid / 10) * 10) * 10 + 1 + 1);
-          glo_der.push_back(m_fitParam_align_local_derivation_x_x->at(ihit));
-          glo_der.push_back(m_fitParam_align_local_derivation_x_rz->at(ihit));
+          labels.push_back(stationid * 10 + 0 + 1); // millepede can not have label at 0
+          labels.push_back(stationid * 10 + 1 + 1);
+          glo_der.push_back(hit[kGlobalYY][ihit]);
+          glo_der.push_back(hit[kGlobalYRz][ihit]);
         }
+      }
 
-        if (dumplayers)
+      loc_der.push_back(hit[kParX][ihit]);
+      loc_der.push_back(hit[kParY][ihit]);
+      loc_der.push_back(hit[kParTheta][ihit]);
+      loc_der.push_back(hit[kParPhi][ihit]);
+      loc_der.push_back(hit[kParQop][ihit]);
+      // std::cout<<"like "<<ievt<<" "<<ihit<<" "<<loc_der.size()<<std::endl;
+      resi.push_back(hit[kResidualX][ihit]);
+      resi_e.push_back(hit[kMeasuredXe][ihit]);
+    }
+    // 每个 hit 的 local/global 个数相同，由上面的开关决定
+    int nrow = resi.size();
+    int nlc = nrow > 0 ? loc_der.size() / nrow : 0;
+    int ngl = nrow > 0 ? glo_der.size() / nrow : 0;
+    if (refit.fit(nrow, nlc, loc_der.data(), resi.data(), resi_e.data()))
+    {
+      // 去掉权重过小的行，其余的 sigma 除以 sqrt(w)
+      int nkeep = 0;
+      for (int irow = 0; irow < nrow; ++irow)
+      {
+        double weight = refit.weights()[irow];
+        if (weight < refit.minWeight())
         {
-          int layerid = moduleid / 100;
-          //	std::cout<<"id "<<moduleid<<" "<<layerid<<std::endl;
-          if (dump6ndf_layers)
-          {
-            if (fabs(m_fitParam_align_global_derivation_y_rx->at(ihit)) > 2 || fabs(m_fitParam_align_global_derivation_y_ry->at(ihit)) > 2)
-              continue;
-            labels.push_back(layerid * 10 + 0 + 1); // millepede can not have label at 0
-            labels.push_back(layerid * 10 + 1 + 1);
-            labels.push_back(layerid * 10 + 2 + 1);
-            labels.push_back(layerid * 10 + 3 + 1);
-            labels.push_back(layerid * 10 + 4 + 1);
-            glo_der.push_back(m_fitParam_align_global_derivation_y_x->at(ihit));
-            glo_der.push_back(m_fitParam_align_global_derivation_y_y->at(ihit));
-            if (dumpz_layers)
-            {
-              labels.push_back(layerid * 10 + 5 + 1);
-              glo_der.push_back(m_fitParam_align_global_derivation_y_z->at(ihit));
-            }
-            glo_der.push_back(m_fitParam_align_global_derivation_y_rx->at(ihit));
-            glo_der.push_back(m_fitParam_align_global_derivation_y_ry->at(ihit));
-            glo_der.push_back(m_fitParam_align_global_derivation_y_rz->at(ihit));
-          }
-          else
-          {
-            labels.push_back(layerid * 10 + 0 + 1); // millepede can not have label at 0
-            labels.push_back(layerid * 10 + 1 + 1);
-            glo_der.push_back(m_fitParam_align_global_derivation_y_y->at(ihit));
-            glo_der.push_back(m_fitParam_align_global_derivation_y_rz->at(ihit));
-          }
+          ++ndropped;
+          continue;
+        }
+        if (weight < 1)
+        {
+          // Cauchy 的权重几乎总小于 1，只统计 sigma 变化超过 1% 的测量
+          if (1 / std::sqrt(weight) > 1.01)
+            ++ndownweighted;
+          resi_e[irow] /= std::sqrt(weight);
         }
+        if (nkeep != irow)
+        {
+          std::copy_n(&loc_der[irow * nlc], nlc, &loc_der[nkeep * nlc]);
+          std::copy_n(&glo_der[irow * ngl], ngl, &glo_der[nkeep * ngl]);
+          std::copy_n(&labels[irow * ngl], ngl, &labels[nkeep * ngl]);
+          resi[nkeep] = resi[irow];
+          resi_e[nkeep] = resi_e[irow];
+        }
+        ++nkeep;
+      }
+      nrow = nkeep;
+    }
+    if (occupancy.enabled())
+    {
+      for (int irow = 0; irow < nrow; ++irow)
+        occupancy.add(labels[irow * ngl]); // moduleid * 10 + 1
+    }
+    // 只监控实际写出的行，sigma 为降权后的值
+    if (monitoring && nrow > 0)
+    {
+      monitor.fillTrack(info.px, info.py, info.pz);
+      for (int irow = 0; irow < nrow; ++irow)
+      {
+        if (resi_e[irow] <= 0) // milleTrack 同样跳过
+          continue;
+        int moduleid = labels[irow * ngl] / 10; // 第一个 label 为 moduleid * 10 + 1
+        monitor.fillHit(resi[irow], resi_e[irow], glo_der[irow * ngl], moduleid * 10 + 1,
+                        dumplayers ? moduleid / 100 * 10 + 1 : 0,
+                        dumpstations ? moduleid / 1000 * 10 + 1 : 0);
+      }
+    }
+    if (nrow > 0)
+      mille_file.milleTrack(nrow, nlc, loc_der.data(), ngl, glo_der.data(), labels.data(),
+                            resi.data(), resi_e.data());
+    mille_file.end();
+    // mille_file.flushTrack();
+  };
 
-        if (dumpstations)
+  // hit cache 读写出错时仍完成转换，但以非零状态退出
+  int status = 0;
+  // 从 hit cache 读取，跳过 ROOT
+  if (from_cache != "")
+  {
+    HitCacheReader cache(from_cache);
+    if (!cache.isOpen())
+      return 1;
+    cout << "Converting " << from_cache << " to " << output << extension << " ..." << endl;
+    TrackView track;
+    while (cache.next(track))
+      convert(track);
+    if (!cache.complete())
+    {
+      std::cerr << "Error: " << from_cache << " is incomplete, the output holds only part of its tracks" << std::endl;
+      status = 1;
+    }
+  }
+  else
+  {
+    // 获取目录中所有的 ROOT 文件
+    vector<string> rootFiles;
+    try
+    {
+      for (const auto &entry : std::filesystem::directory_iterator(input))
+      {
+        if (entry.is_regular_file())
         {
-          int stationid = moduleid / 1000;
-          if (dump6ndf_stations)
-          {
-            labels.push_back(stationid * 10 + 0 + 1); // millepede can not have label at 0
-            labels.push_back(stationid * 10 + 1 + 1);
-            labels.push_back(stationid * 10 + 2 + 1);
-            labels.push_back(stationid * 10 + 3 + 1);
-            labels.push_back(stationid * 10 + 4 + 1);
-            labels.push_back(stationid * 10 + 5 + 1);
-            glo_der.push_back(m_fitParam_align_global_derivation_y_x->at(ihit));
-            glo_der.push_back(m_fitParam_align_global_derivation_y_y->at(ihit));
-            glo_der.push_back(m_fitParam_align_global_derivation_y_z->at(ihit));
-            glo_der.push_back(m_fitParam_align_global_derivation_y_rx->at(ihit));
-            glo_der.push_back(m_fitParam_align_global_derivation_y_ry->at(ihit));
-            glo_der.push_back(m_fitParam_align_global_derivation_y_rz->at(ihit));
-          }
-          else
+          if (entry.path().extension().string() == ".root")
           {
-            labels.push_back(stationid * 10 + 0 + 1); // millepede can not have label at 0
-            labels.push_back(stationid * 10 + 1 + 1);
-            glo_der.push_back(m_fitParam_align_global_derivation_y_y->at(ihit));
-            glo_der.push_back(m_fitParam_align_global_derivation_y_rz->at(ihit));
+            rootFiles.push_back(entry.path().string());
           }
         }
+      }
+    }
+    catch (const std::filesystem::filesystem_error &ex)
+    {
+      std::cerr << "Error accessing directory " << input << ": " << ex.what() << std::endl;
+      return 1;
+    }
+    // 排序文件列表以确保处理顺序一致
+    std::sort(rootFiles.begin(), rootFiles.end());
+    cout << "Found " << rootFiles.size() << " ROOT files in " << input << endl;
+    cout << "Converting " << input << " to " << output << extension << " ..." << endl;
+
+    std::unique_ptr<HitCacheWriter> cache;
+    if (write_cache != "")
+    {
+      cache = std::make_unique<HitCacheWriter>(write_cache);
+      if (!cache->isOpen())
+        return 1;
+    }
+
+    // 遍历所有找到的 ROOT 文件
+    TrackHits track;
+    for (size_t fileIndex = 0; fileIndex < rootFiles.size(); ++fileIndex)
+    {
+      const string &InputFileName = rootFiles[fileIndex];
+      cout << "Dealing with File " << fileIndex + 1 << "/" << rootFiles.size()
+           << ": " << InputFileName << " ..." << endl;
+      // if(fileId==29)continue;
+      // if(fileId==14)continue;
+      // if(fileId==31)continue;
+      // if(fileId==40)continue;
+
+      // 读取 tree 树
+      TFile *f1 = TFile::Open(InputFileName.c_str(), "READ");
+      if (!f1 || f1->IsZombie())
+      {
+        std::cerr << "Error: Cannot open file " << InputFileName << std::endl;
+        if (f1)
+          f1->Close();
+        continue; // 跳过这个文件，继续处理下一个
+      }
+      TTree *t1 = (TTree *)f1->Get("tree");
+      if (!t1)
+      {
+        std::cerr << "Error: Cannot find tree 'tree' in " << InputFileName << std::endl;
+        f1->Close();
+        continue;
+      }
+
+      // 存储 28 个 branches
+      double m_fitParam_x = 0;
+      double m_fitParam_y = 0;
+      double m_fitParam_chi2 = 0;
+      double m_fitParam_px = 0;
+      double m_fitParam_py = 0;
+      double m_fitParam_pz = 0;
+      double m_fitParam_charge = 0;
+      std::vector<double> *m_fitParam_align_global_derivation_y_x = 0;
+      std::vector<double> *m_fitParam_align_global_derivation_y_y = 0;
+      std::vector<double> *m_fitParam_align_global_derivation_y_z = 0;
+      std::vector<double> *m_fitParam_align_global_derivation_y_rx = 0;
+      std::vector<double> *m_fitParam_align_global_derivation_y_ry = 0;
+      std::vector<double> *m_fitParam_align_global_derivation_y_rz = 0;
+      std::vector<double> *m_fitParam_align_local_derivation_x_x = 0;
+      std::vector<double> *m_fitParam_align_local_derivation_x_y = 0;
+      std::vector<double> *m_fitParam_align_local_derivation_x_z = 0;
+      std::vector<double> *m_fitParam_align_local_derivation_x_rx = 0;
+      std::vector<double> *m_fitParam_align_local_derivation_x_ry = 0;
+      std::vector<double> *m_fitParam_align_local_derivation_x_rz = 0;
+      std::vector<double> *m_fitParam_align_local_residual_x = 0;
+      std::vector<double> *m_fitParam_align_local_measured_x = 0;
+      std::vector<double> *m_fitParam_align_local_measured_xe = 0;
+      std::vector<double> *m_fitParam_align_id = 0;
+      std::vector<double> *m_fitParam_align_local_derivation_x_par_x = 0;
+      std::vector<double> *m_fitParam_align_local_derivation_x_par_y = 0;
+      std::vector<double> *m_fitParam_align_local_derivation_x_par_theta = 0;
+      std::vector<double> *m_fitParam_align_local_derivation_x_par_phi = 0;
+      std::vector<double> *m_fitParam_align_local_derivation_x_par_qop = 0;
+      t1->SetBranchAddress("fitParam_x", &m_fitParam_x);
+      t1->SetBranchAddress("fitParam_y", &m_fitParam_y);
+      t1->SetBranchAddress("fitParam_chi2", &m_fitParam_chi2);
+      t1->SetBranchAddress("fitParam_px", &m_fitParam_px);
+      t1->SetBranchAddress("fitParam_py", &m_fitParam_py);
+      t1->SetBranchAddress("fitParam_pz", &m_fitParam_pz);
+      t1->SetBranchAddress("fitParam_charge", &m_fitParam_charge);
+      t1->SetBranchAddress("fitParam_align_global_derivation_y_x", &m_fitParam_align_global_derivation_y_x);
+      t1->SetBranchAddress("fitParam_align_global_derivation_y_y", &m_fitParam_align_global_derivation_y_y);
+      t1->SetBranchAddress("fitParam_align_global_derivation_y_z", &m_fitParam_align_global_derivation_y_z);
+      t1->SetBranchAddress("fitParam_align_global_derivation_y_rx", &m_fitParam_align_global_derivation_y_rx);
+      t1->SetBranchAddress("fitParam_align_global_derivation_y_ry", &m_fitParam_align_global_derivation_y_ry);
+      t1->SetBranchAddress("fitParam_align_global_derivation_y_rz", &m_fitParam_align_global_derivation_y_rz);
+      t1->SetBranchAddress("fitParam_align_local_derivation_x_x", &m_fitParam_align_local_derivation_x_x);
+      t1->SetBranchAddress("fitParam_align_local_derivation_x_y", &m_fitParam_align_local_derivation_x_y);
+      t1->SetBranchAddress("fitParam_align_local_derivation_x_z", &m_fitParam_align_local_derivation_x_z);
+      t1->SetBranchAddress("fitParam_align_local_derivation_x_rx", &m_fitParam_align_local_derivation_x_rx);
+      t1->SetBranchAddress("fitParam_align_local_derivation_x_ry", &m_fitParam_align_local_derivation_x_ry);
+      t1->SetBranchAddress("fitParam_align_local_derivation_x_rz", &m_fitParam_align_local_derivation_x_rz);
+      t1->SetBranchAddress("fitParam_align_local_residual_x", &m_fitParam_align_local_residual_x);
+      t1->SetBranchAddress("fitParam_align_local_measured_x", &m_fitParam_align_local_measured_x);
+      t1->SetBranchAddress("fitParam_align_local_measured_xe", &m_fitParam_align_local_measured_xe);
+      t1->SetBranchAddress("fitParam_align_id", &m_fitParam_align_id);
+      t1->SetBranchAddress("fitParam_align_local_derivation_x_par_x", &m_fitParam_align_local_derivation_x_par_x);
+      t1->SetBranchAddress("fitParam_align_local_derivation_x_par_y", &m_fitParam_align_local_derivation_x_par_y);
+      t1->SetBranchAddress("fitParam_align_local_derivation_x_par_theta", &m_fitParam_align_local_derivation_x_par_theta);
+      t1->SetBranchAddress("fitParam_align_local_derivation_x_par_phi", &m_fitParam_align_local_derivation_x_par_phi);
+      t1->SetBranchAddress("fitParam_align_local_derivation_x_par_qop", &m_fitParam_align_local_derivation_x_par_qop);
+
+      // 与 HitColumn 顺序一致
+      const std::vector<double> *const *columns[kNumHitColumns] = {
+          &m_fitParam_align_local_residual_x,
+          &m_fitParam_align_local_measured_xe,
+          &m_fitParam_align_local_derivation_x_x,
+          &m_fitParam_align_local_derivation_x_y,
+          &m_fitParam_align_local_derivation_x_z,
+          &m_fitParam_align_local_derivation_x_rx,
+          &m_fitParam_align_local_derivation_x_ry,
+          &m_fitParam_align_local_derivation_x_rz,
+          &m_fitParam_align_global_derivation_y_x,
+          &m_fitParam_align_global_derivation_y_y,
+          &m_fitParam_align_global_derivation_y_z,
+          &m_fitParam_align_global_derivation_y_rx,
+          &m_fitParam_align_global_derivation_y_ry,
+          &m_fitParam_align_global_derivation_y_rz,
+          &m_fitParam_align_local_derivation_x_par_x,
+          &m_fitParam_align_local_derivation_x_par_y,
+          &m_fitParam_align_local_derivation_x_par_theta,
+          &m_fitParam_align_local_derivation_x_par_phi,
+          &m_fitParam_align_local_derivation_x_par_qop};
+
+      int nevt = t1->GetEntries();
+
+      // 分区所需的 run/time 信息：优先读 tree 中的 leaf，run 也可从文件路径解析
+      TLeaf *runLeaf = t1->GetLeaf("runNumber");
+      TLeaf *timeLeaf = t1->GetLeaf("eventTime");
+      long long fileRun = runFromPath(InputFileName);
+      if (partition == "run" && !runLeaf && fileRun < 0)
+        std::cerr << "Warning: No run number for " << InputFileName << ", writing to run_unknown" << std::endl;
+      if (partition == "time" && !timeLeaf)
+        std::cerr << "Warning: No eventTime leaf in " << InputFileName << ", writing to time_unknown" << std::endl;
+
+      for (int ievt = 0; ievt < nevt; ++ievt)
+      {
+        t1->GetEntry(ievt);
+
+        // 取出通过 -9000 检查的 hits
+        track.clear();
+        TrackInfo &info = track.info;
+        info.x = m_fitParam_x;
+        info.y = m_fitParam_y;
+        info.chi2 = m_fitParam_chi2;
+        info.px = m_fitParam_px;
+        info.py = m_fitParam_py;
+        info.pz = m_fitParam_pz;
+        info.charge = m_fitParam_charge;
+        info.nRawHits = m_fitParam_align_id->size();
+        info.run = runLeaf ? static_cast<long long>(runLeaf->GetValue()) : fileRun;
+        info.time = timeLeaf ? static_cast<long long>(std::floor(timeLeaf->GetValue())) : -1;
+        for (size_t ihit = 0; ihit < m_fitParam_align_id->size(); ++ihit)
+        {
+          if (m_fitParam_align_local_derivation_x_x->at(ihit) < -9000 || m_fitParam_align_local_derivation_x_rz->at(ihit) < -9000 || m_fitParam_align_global_derivation_y_x->at(ihit) < -9000 || m_fitParam_align_global_derivation_y_y->at(ihit) < -9000 || m_fitParam_align_global_derivation_y_z->at(ihit) < -9000 || m_fitParam_align_global_derivation_y_rx->at(ihit) < -9000 || m_fitParam_align_global_derivation_y_ry->at(ihit) < -9000 || m_fitParam_align_global_derivation_y_rz->at(ihit) < -9000)
+            continue;
+          track.id.push_back(m_fitParam_align_id->at(ihit));
+          for (int c = 0; c < kNumHitColumns; ++c)
+            track.hit[c].push_back((*columns[c])->at(ihit));
+        }
 
-        loc_der.push_back(m_fitParam_align_local_derivation_x_par_x->at(ihit));
-        loc_der.push_back(m_fitParam_align_local_derivation_x_par_y->at(ihit));
-        loc_der.push_back(m_fitParam_align_local_derivation_x_par_theta->at(ihit));
-        loc_der.push_back(m_fitParam_align_local_derivation_x_par_phi->at(ihit));
-        loc_der.push_back(m_fitParam_align_local_derivation_x_par_qop->at(ihit));
-        // std::cout<<"like "<<ievt<<" "<<ihit<<" "<<loc_der.size()<<std::endl;
-        float *lcder = loc_der.data();
-        float *glder = glo_der.data();
-        int *label = labels.data();
-        resi = m_fitParam_align_local_residual_x->at(ihit);
-        resi_e = m_fitParam_align_local_measured_xe->at(ihit);
-        mille_file.mille(loc_der.size(), lcder, glo_der.size(), glder, label, resi, resi_e);
+        TrackView view = track.view();
+        if (cache)
+          cache->write(view);
+        convert(view);
       }
-      mille_file.end();
-      // mille_file.flushTrack();
+
+      // 关闭当前文件
+      f1->Close();
+      monitor_total.merge(monitor);
+      monitor = Monitor();
+    }
+    if (cache)
+    {
+      if (cache->close())
+        cout << "Wrote " << cache->numTracks() << " tracks with " << cache->numHits()
+             << " hits to " << write_cache << endl;
+      else
+        status = 1;
     }
+  }
+  if (dedup)
+  {
+    cout << "Removed " << nduplicates << " duplicated tracks, " << seen.size()
+         << " distinct tracks kept" << endl;
+  }
+  if (refit.enabled())
+  {
+    cout << "Robust refit dropped " << ndropped << " measurements and scaled the sigma of "
+         << ndownweighted << " by more than 1%" << endl;
+  }
+  if (prescaler.enabled() || max_hits > 0)
+  {
+    cout << "Accepted " << ioutput << " tracks, " << nprescaled << " tracks prescaled away, "
+         << ncapped << " hits dropped by the module cap" << endl;
+  }
+  if (monitoring)
+  {
+    monitor_total.merge(monitor);
+    if (monitor_total.write(monitor_file))
+      cout << "Wrote monitoring histograms to " << monitor_file << endl;
+  }
+  if (partition != "")
+  {
+    cout << "Wrote " << mille_files.size() << " partitions of " << output << extension << endl;
+  }
+  vector<string> outputFiles = mille_files.fileNames();
+  mille_files.close();
 
-    // 关闭当前文件
-    f1->Close();
+  // 按 layer signature 重排 records，提高 pede 累加矩阵时的局部性
+  if (sort)
+  {
+    RecordSorter sorter(static_cast<size_t>(sort_memory) << 20);
+    for (const string &outputFile : outputFiles)
+    {
+      if (!sorter.sort(outputFile))
+        continue;
+      cout << "Sorted " << sorter.numRecords() << " records of " << outputFile << " in "
+           << sorter.numRuns() << " runs, layer signature changes " << sorter.changesBefore()
+           << " -> " << sorter.changesAfter() << endl;
+    }
   }
-  mille_file.kill();
+  return status;
 }
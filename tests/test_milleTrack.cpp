@@ -0,0 +1,181 @@
+// Mille::milleTrack 和 Mille::mille 必须写出与原始逐行 Mille 编码完全相同的文件
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Mille.hpp"
+
+namespace
+{
+  /// Independent copy of the baseline per-measurement Mille encoder (mille, end, newSet, checkBufferSize).
+  class ReferenceMille
+  {
+  public:
+    ReferenceMille(bool asBinary, bool writeZero) : myAsBinary(asBinary), myWriteZero(writeZero) {}
+
+    void mille(int NLC, const float *derLc, int NGL, const float *derGl, const int *label,
+               float rMeas, float sigma)
+    {
+      if (sigma <= 0.)
+        return;
+      if (myBufferPos == -1)
+        newSet();
+      if (myBufferPos + NLC + NGL + 2 >= kBufferSize)
+      {
+        ++myBufferInt[0];
+        return;
+      }
+      push(rMeas, 0);
+      for (int i = 0; i < NLC; ++i)
+        if (derLc[i] || myWriteZero)
+          push(derLc[i], i + 1);
+      push(sigma, 0);
+      for (int i = 0; i < NGL; ++i)
+        if ((derGl[i] || myWriteZero) && (label[i] > 0 || myWriteZero) && label[i] <= kMaxLabel)
+          push(derGl[i], label[i]);
+    }
+
+    void end()
+    {
+      if (myBufferPos > 0)
+      {
+        const int numWordsToWrite = (myBufferPos + 1) * 2;
+        if (myAsBinary)
+        {
+          myOut.write(reinterpret_cast<const char *>(&numWordsToWrite), sizeof(numWordsToWrite));
+          myOut.write(reinterpret_cast<const char *>(myBufferFloat.data()), (myBufferPos + 1) * sizeof(float));
+          myOut.write(reinterpret_cast<const char *>(myBufferInt.data()), (myBufferPos + 1) * sizeof(int));
+        }
+        else
+        {
+          myOut << numWordsToWrite << "\n";
+          for (int i = 0; i < myBufferPos + 1; ++i)
+            myOut << myBufferFloat[i] << " ";
+          myOut << "\n";
+          for (int i = 0; i < myBufferPos + 1; ++i)
+            myOut << myBufferInt[i] << " ";
+          myOut << "\n";
+        }
+      }
+      myBufferPos = -1;
+    }
+
+    std::string data() const { return myOut.str(); }
+
+  private:
+    enum
+    {
+      kBufferSize = 5000,
+      kMaxLabel = 0x7FFFFFFF
+    };
+
+    void newSet()
+    {
+      myBufferPos = 0;
+      myBufferFloat[0] = 0.;
+      myBufferInt[0] = 0;
+    }
+
+    void push(float value, int index)
+    {
+      ++myBufferPos;
+      myBufferFloat[myBufferPos] = value;
+      myBufferInt[myBufferPos] = index;
+    }
+
+    bool myAsBinary;
+    bool myWriteZero;
+    std::ostringstream myOut;
+    std::vector<float> myBufferFloat = std::vector<float>(kBufferSize);
+    std::vector<int> myBufferInt = std::vector<int>(kBufferSize);
+    int myBufferPos = -1;
+  };
+
+  std::string readFile(const std::string &fileName)
+  {
+    std::ifstream in(fileName, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+
+  bool check(const std::string &name, const char *writer, const std::string &data, const std::string &reference)
+  {
+    if (reference.empty() || data != reference)
+    {
+      std::cerr << name << ": " << writer << " wrote " << data.size() << " bytes, the reference encoder "
+                << reference.size() << " bytes, files differ" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  /// Write the same random tracks through mille(), milleTrack() and the reference encoder and compare.
+  bool compare(bool asBinary, bool writeZero)
+  {
+    const std::string name = std::string("test_milleTrack_") + (asBinary ? "bin" : "txt") + (writeZero ? "_zero" : "");
+    const std::string rowsName = name + "_rows";
+    const std::string trackName = name + "_track";
+    ReferenceMille reference(asBinary, writeZero);
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> value(-1., 1.);
+    std::uniform_int_distribution<int> pick(0, 9);
+    {
+      Mille rows(rowsName.c_str(), asBinary, writeZero);
+      Mille track(trackName.c_str(), asBinary, writeZero);
+      const int nlc = 5;
+      for (int itrack = 0; itrack < 200; ++itrack)
+      {
+        const int ngl = 1 + itrack % 8;
+        // 最后一条 track 超出 Mille 的 buffer，检查溢出时的行为也相同
+        const int nhit = itrack == 199 ? 400 : 1 + pick(rng) * 2;
+        std::vector<float> loc_der(nhit * nlc), glo_der(nhit * ngl), resi(nhit), resi_e(nhit);
+        std::vector<int> labels(nhit * ngl);
+        for (int ihit = 0; ihit < nhit; ++ihit)
+        {
+          for (int i = 0; i < nlc; ++i)
+            loc_der[ihit * nlc + i] = pick(rng) == 0 ? 0.f : value(rng);
+          for (int i = 0; i < ngl; ++i)
+          {
+            glo_der[ihit * ngl + i] = pick(rng) == 0 ? 0.f : value(rng);
+            labels[ihit * ngl + i] = pick(rng) == 0 ? 0 : 10000 + 10 * ihit + i + 1; // 0 为无效 label
+          }
+          resi[ihit] = value(rng) * 0.05f;
+          resi_e[ihit] = pick(rng) == 0 ? 0.f : 0.01f + value(rng) * 0.005f; // sigma <= 0 的行被跳过
+        }
+        for (int ihit = 0; ihit < nhit; ++ihit)
+        {
+          rows.mille(nlc, &loc_der[ihit * nlc], ngl, &glo_der[ihit * ngl], &labels[ihit * ngl],
+                     resi[ihit], resi_e[ihit]);
+          reference.mille(nlc, &loc_der[ihit * nlc], ngl, &glo_der[ihit * ngl], &labels[ihit * ngl],
+                          resi[ihit], resi_e[ihit]);
+        }
+        rows.end();
+        reference.end();
+        track.milleTrack(nhit, nlc, loc_der.data(), ngl, glo_der.data(), labels.data(),
+                         resi.data(), resi_e.data());
+        track.end();
+      }
+    }
+    const std::string expected = reference.data();
+    const bool ok = check(name, "mille()", readFile(rowsName), expected) &
+                    check(name, "milleTrack()", readFile(trackName), expected);
+    std::remove(rowsName.c_str());
+    std::remove(trackName.c_str());
+    if (ok)
+      std::cout << name << ": " << expected.size() << " bytes identical" << std::endl;
+    return ok;
+  }
+}
+
+int main()
+{
+  bool ok = true;
+  ok &= compare(true, false);
+  ok &= compare(false, false);
+  ok &= compare(true, true);
+  return ok ? 0 : 1;
+}